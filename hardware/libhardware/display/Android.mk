@@ -26,6 +26,8 @@ LOCAL_C_INCLUDES += $(LOCAL_PATH) \
 	
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_SHARED_LIBRARIES := liblog libcutils
-LOCAL_SRC_FILES := display.cpp
+LOCAL_SRC_FILES := display.cpp \
+	display_g2d.cpp \
+	display_scale.cpp
 LOCAL_MODULE := display.sun4i
 include $(BUILD_SHARED_LIBRARY)
@@ -18,12 +18,17 @@
 #define LOG_TAG "display"
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
+#include <cutils/atomic.h>
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 #ifdef HAVE_ANDROID_OS      // just want PAGE_SIZE define
 #include <asm/page.h>
 #else
@@ -32,8 +37,14 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <poll.h>
 
 #include <hardware/display.h>
+#include "display_priv.h"
+#include "display_g2d.h"
+#include "display_scale.h"
 #include <drv_display_sun4i.h>
 #include <g2d_driver.h>
 #include <fb.h>
@@ -43,18 +54,161 @@
 
 #define LOG_NDEBUG          0
 
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC   _IOW('F', 0x20, __u32)
+#endif
+
+/* slave buffers the DUALSAME mirror cycles through */
+#define MIRROR_MAX_BUFFERS  3
+#define MIRROR_MAX_RECTS    8
+/* how long stopping the mirror waits for its thread, in ms */
+#define MIRROR_STOP_TIMEOUT 100
+
 int                         g_displaymode = 0;
 int                         g_masterdisplay = 0;
 struct display_output_t     g_display[MAX_DISPLAY_NUM];
 pthread_mutex_t             mode_lock;
 bool                        mutex_inited = false;
+
+/*
+ * What we know about a framebuffer, so that the per-frame calls don't
+ * have to open and map it again. display_requestfb and display_releasefb
+ * drop the entry, but gralloc changes the mode of fb0 and fb1 behind our
+ * back, so var is asked again on every use; fix only when the layout in
+ * var moved, and the mapping is dropped when the memory did. An entry,
+ * and the mapping in it, only hold still while mCacheLock is held.
+ */
+struct display_fbinfo_t
+{
+    bool                        valid;          // fix and var are current
+    struct fb_fix_screeninfo    fix;
+    struct fb_var_screeninfo    var;
+    uint32_t                    layermask;      // bit n: layer_hdl[n] is current
+    unsigned long               layer_hdl[MAX_DISPLAY_NUM];
+    void*                       base;           // mmapped, for the software copy
+    size_t                      mapsize;
+};
+
+/*
+ * Up to MIRROR_MAX_RECTS rectangles, count < 0 is the whole surface.
+ * More rectangles than that are merged into their bounding box.
+ */
+struct display_damage_t
+{
+    int                         count;
+    struct display_rect_t       rects[MIRROR_MAX_RECTS];
+};
+
+/*
+ * The DUALSAME mirror: a thread that wakes on every vsync of the master,
+ * and when the master has flipped, blits the new front buffer into the
+ * next slave buffer and pans the slave to it. The counters are only
+ * written by the thread, but for numPosts.
+ *
+ * Each slave buffer keeps what changed on the master since it was last
+ * drawn into, so that only that much has to be blitted again. Damage
+ * reported with setmirrordamage collects in incoming, under damagelock,
+ * until the thread picks up the frame it belongs to.
+ *
+ * The thread is detached and only knows its display_mirrorrun_t. Once
+ * told to stop it touches nothing else, so that a thread stuck waiting
+ * for a vsync that never comes can be left behind.
+ */
+struct display_mirrorrun_t
+{
+    struct display_context_t*   ctx;
+    volatile int32_t            stop;
+    volatile int32_t            exited;
+    volatile int32_t            refs;           // the thread's and display_mirror_stop's
+};
+
+struct display_mirror_t
+{
+    struct display_mirrorrun_t* run;            // NULL when there is no thread, under mode_lock
+    volatile int32_t            ownedfb;        // slave fb while the thread runs, else -1
+    volatile int                generation;     // bumped on every mode change
+    int                         verbose;        // debug.display.mirror=2
+    int                         slavebuf;       // slave buffer last panned to
+    uint32_t                    numFrames;      // master frames mirrored
+    uint32_t                    numDropped;     // master frames never mirrored, or failed copies
+    uint32_t                    numSkipped;     // vsyncs the mode lock was held
+    int64_t                     latencyNs;      // vsync to slave pan, summed
+    int64_t                     maxLatencyNs;
+    int64_t                     lastLogNs;
+    uint64_t                    blitPixels;     // slave pixels blitted
+    uint64_t                    fullPixels;     // the same, had every frame been copied whole
+
+    pthread_mutex_t             damagelock;
+    bool                        damaged;        // incoming holds this frame's damage
+    uint32_t                    numPosts;       // setmirrordamage calls, one per master frame
+    struct display_damage_t     incoming;
+    struct display_damage_t     pending[MIRROR_MAX_BUFFERS];
+};
+
+/* what the HDMI driver may be asked about, in the order of the mode bitmap */
+struct display_hdmimode_t
+{
+    int                         format;         // DISPLAY_TVFORMAT_*
+    int                         mode;           // DISP_TV_MOD_*
+    int                         width;
+    int                         height;
+    int                         refresh;
+    bool                        interlaced;
+};
+
+static const struct display_hdmimode_t hdmi_modes[] =
+{
+    { DISPLAY_TVFORMAT_480I,        DISP_TV_MOD_480I,        720,  480,  60, true  },
+    { DISPLAY_TVFORMAT_576I,        DISP_TV_MOD_576I,        720,  576,  50, true  },
+    { DISPLAY_TVFORMAT_480P,        DISP_TV_MOD_480P,        720,  480,  60, false },
+    { DISPLAY_TVFORMAT_576P,        DISP_TV_MOD_576P,        720,  576,  50, false },
+    { DISPLAY_TVFORMAT_720P_50HZ,   DISP_TV_MOD_720P_50HZ,   1280, 720,  50, false },
+    { DISPLAY_TVFORMAT_720P_60HZ,   DISP_TV_MOD_720P_60HZ,   1280, 720,  60, false },
+    { DISPLAY_TVFORMAT_1080I_50HZ,  DISP_TV_MOD_1080I_50HZ,  1920, 1080, 50, true  },
+    { DISPLAY_TVFORMAT_1080I_60HZ,  DISP_TV_MOD_1080I_60HZ,  1920, 1080, 60, true  },
+    { DISPLAY_TVFORMAT_1080P_24HZ,  DISP_TV_MOD_1080P_24HZ,  1920, 1080, 24, false },
+    { DISPLAY_TVFORMAT_1080P_50HZ,  DISP_TV_MOD_1080P_50HZ,  1920, 1080, 50, false },
+    { DISPLAY_TVFORMAT_1080P_60HZ,  DISP_TV_MOD_1080P_60HZ,  1920, 1080, 60, false },
+};
+
+/*
+ * Hotplug monitor: a thread reading kernel uevents, which the sun4i
+ * display driver sends through the hdmi and tv switch devices. It keeps
+ * g_display[].hotplug current and tells whoever registered a callback.
+ *
+ * mode_lock is never taken with lock held: the thread takes mode_lock on
+ * its own, and lock can be taken by someone already holding mode_lock.
+ */
+struct display_hotplug_t
+{
+    pthread_t                   thread;
+    bool                        running;
+    volatile int32_t            live;           // the thread has read the state, mHdmiHpd is current
+    int                         sock;           // NETLINK_KOBJECT_UEVENT
+    int                         wake[2];        // written to by close to stop the thread
+    pthread_mutex_t             lock;           // guards callback and cookie
+    display_hotplug_callback_t  callback;
+    void*                       cookie;
+};
+
 /** State information for each device instance */
 struct display_context_t 
 {
-    struct display_device_t     device;
+    struct display_device_ext_t device;
+    pthread_mutex_t             mCacheLock;     // recursive, guards the lazily opened state below
     int                         mFD_fb[MAX_DISPLAY_NUM];
     int		                    mFD_disp;
-    int                         mFD_mp;
+    int                         mFD_mp;         // -1: there is no g2d, copy in software
+    struct display_g2dstats_t   mG2dStats;
+    struct display_workers_t*   mWorkers;
+    bool                        mSoftOnly;      // debug.display.soft=1
+    int                         mSoftFilter;    // debug.display.softfilter
+    volatile int32_t            mHdmiHpd;       // last hotplug status seen, read without a lock
+    bool                        mHdmiProbed;    // mHdmiModes is current
+    uint32_t                    mHdmiModes;     // bit n: hdmi_modes[n] is supported
+    struct display_fbinfo_t     mFbInfo[MAX_DISPLAY_NUM];
+    struct display_mirror_t     mMirror;
+    struct display_hotplug_t    mHotplug;
 };
 
 struct display_fbpara_t
@@ -121,93 +275,148 @@ struct display_module_t HAL_MODULE_INFO_SYM =
 static int display_gethdmistatus(struct display_device_t *dev)
 {
     struct display_context_t* ctx = (struct display_context_t*)dev;
+    int                       status;
     
     if(ctx)
     {
+        if(android_atomic_acquire_load(&ctx->mHotplug.live))
+        {
+            // kept current by the hotplug monitor
+            return  android_atomic_acquire_load(&ctx->mHdmiHpd);
+        }
+
         if(ctx->mFD_disp)
         {
         	unsigned long args[4];
         	
         	args[0] = 0;
         	
-            return ioctl(ctx->mFD_disp,DISP_CMD_HDMI_GET_HPD_STATUS,args);
+            status = ioctl(ctx->mFD_disp,DISP_CMD_HDMI_GET_HPD_STATUS,args);
+            if(status != android_atomic_acquire_load(&ctx->mHdmiHpd))
+            {
+                // plugged, unplugged or another sink: its modes are to be asked again
+                android_atomic_release_store(status,&ctx->mHdmiHpd);
+                ctx->mHdmiProbed    = false;
+            }
+
+            return  status;
         }
     }
 
     return 0;    
 }
 
+/* the supported HDMI modes as a bitmap of hdmi_modes indices, probed once per plug */
+static uint32_t display_gethdmimodes(struct display_context_t* ctx)
+{
+    unsigned long               args[4];
+    uint32_t                    modes = 0;
+    unsigned int                i;
+
+    if(ctx->mHdmiProbed)
+    {
+        return  ctx->mHdmiModes;
+    }
+
+    for(i = 0;i < sizeof(hdmi_modes) / sizeof(hdmi_modes[0]);i++)
+    {
+        args[0] = 0;
+        args[1] = hdmi_modes[i].mode;
+        if(ioctl(ctx->mFD_disp,DISP_CMD_HDMI_SUPPORT_MODE,args) > 0)
+        {
+            modes |= 1 << i;
+        }
+    }
+    LOGD("hdmi modes: %x\n",modes);
+
+    ctx->mHdmiModes     = modes;
+    ctx->mHdmiProbed    = true;
+
+    return  modes;
+}
+
 static int display_gethdmimaxmode(struct display_device_t *dev)
 {
+    // best first
+    static const int            preferred[] =
+    {
+        DISPLAY_TVFORMAT_1080P_60HZ,
+        DISPLAY_TVFORMAT_1080P_50HZ,
+        DISPLAY_TVFORMAT_720P_60HZ,
+        DISPLAY_TVFORMAT_720P_50HZ,
+        DISPLAY_TVFORMAT_1080I_60HZ,
+        DISPLAY_TVFORMAT_1080I_50HZ,
+    };
     struct display_context_t* ctx = (struct display_context_t*)dev;
+    uint32_t                  modes;
+    unsigned int              i;
+    unsigned int              j;
     
-    if(ctx)
+    if(ctx && ctx->mFD_disp)
     {
-        if(ctx->mFD_disp)
+        modes = display_gethdmimodes(ctx);
+        for(i = 0;i < sizeof(preferred) / sizeof(preferred[0]);i++)
         {
-        	unsigned long args[4];
-        	
-        	args[0] = 0;
-        	args[1] = DISP_TV_MOD_1080P_60HZ;
-
-            if(ioctl(ctx->mFD_disp,DISP_CMD_HDMI_SUPPORT_MODE,args))
+            for(j = 0;j < sizeof(hdmi_modes) / sizeof(hdmi_modes[0]);j++)
             {
-                return DISPLAY_TVFORMAT_1080P_60HZ;
-            }
-            else 
-            {
-            	args[1] = DISP_TV_MOD_1080P_50HZ;
-
-	            if(ioctl(ctx->mFD_disp,DISP_CMD_HDMI_SUPPORT_MODE,args))
-	            {
-	                return DISPLAY_TVFORMAT_1080P_50HZ;
-	            }
-	            else 
-	            {
-	            	args[1] = DISPLAY_TVFORMAT_720P_60HZ;
-
-		            if(ioctl(ctx->mFD_disp,DISP_CMD_HDMI_SUPPORT_MODE,args))
-		            {
-		                return DISPLAY_TVFORMAT_720P_60HZ;
-		            }
-		            else
-		            {
-		            	args[1] = DISP_TV_MOD_720P_50HZ;
-
-			            if(ioctl(ctx->mFD_disp,DISP_CMD_HDMI_SUPPORT_MODE,args))
-			            {
-			                return DISPLAY_TVFORMAT_720P_50HZ;
-			            }
-			            else
-			            {
-			            	args[1] = DISP_TV_MOD_1080I_60HZ;
-
-				            if(ioctl(ctx->mFD_disp,DISP_CMD_HDMI_SUPPORT_MODE,args))
-				            {
-				                return DISPLAY_TVFORMAT_1080I_60HZ;
-				            }
-				            else
-				            {
-				            	args[1] = DISP_TV_MOD_1080I_50HZ;
-
-					            if(ioctl(ctx->mFD_disp,DISP_CMD_HDMI_SUPPORT_MODE,args))
-					            {
-					                return DISPLAY_TVFORMAT_1080I_50HZ;
-					            }
-					            else
-					            {
-					            	return DISPLAY_TVFORMAT_720P_50HZ;
-					            }
-				            }
-			            }
-		            }
-	            }
+                if(hdmi_modes[j].format == preferred[i] && (modes & (1 << j)))
+                {
+                    return  preferred[i];
+                }
             }
         }
     }
 
     return DISPLAY_TVFORMAT_720P_50HZ;    
-}      
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_gethdmimodelist
+*
+* Description:      every HDMI mode the sink takes, with its geometry and refresh. answered from the probed bitmap 
+*
+* parameters:       modes: filled with up to max entries, may be NULL to only count them
+*
+* return:           the number of supported modes, which can be more than max
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int display_gethdmimodelist(struct display_device_t *dev,struct display_modeinfo_t *modes,int max)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)dev;
+    uint32_t                    supported;
+    unsigned int                i;
+    int                         count = 0;
+
+    if(!ctx->mFD_disp)
+    {
+        return  0;
+    }
+
+    supported = display_gethdmimodes(ctx);
+    for(i = 0;i < sizeof(hdmi_modes) / sizeof(hdmi_modes[0]);i++)
+    {
+        if(!(supported & (1 << i)))
+        {
+            continue;
+        }
+
+        if(modes && count < max)
+        {
+            modes[count].format     = hdmi_modes[i].format;
+            modes[count].width      = hdmi_modes[i].width;
+            modes[count].height     = hdmi_modes[i].height;
+            modes[count].refresh    = hdmi_modes[i].refresh;
+            modes[count].interlaced = hdmi_modes[i].interlaced;
+        }
+        count++;
+    }
+
+    return  count;
+}
+      
 /*
 **********************************************************************************************************************
 *                                               display_gettvdacstatus
@@ -543,409 +752,635 @@ static int display_gethotplug(struct display_device_t *dev,int displayno)
     return  0;
 }
 
-static int get_g2dpixelformat(int red_size,int red_offset,
-                              int green_size,int green_offset,
-                              int blue_size,int blue_offset,
-                              int alpha_size,int alpha_offset)
-{
-    if((red_size == 8) && (red_offset = 0)
-       && (green_size == 8) && (green_offset = 8)
-       && (blue_size == 8) && (blue_offset = 16)
-       && (alpha_size == 8) && (alpha_offset = 24))
-    {
-        return G2D_FMT_ABGR_AVUY8888;
-    }
-    else if((red_size == 8) && (red_offset = 16)
-       && (green_size == 8) && (green_offset = 8)
-       && (blue_size == 8) && (blue_offset = 0)
-       && (alpha_size == 8) && (alpha_offset = 24))
-    {
-        return G2D_FMT_ARGB_AYUV8888;
-    }
-    else if((red_size == 8) && (red_offset = 8)
-       && (green_size == 8) && (green_offset = 16)
-       && (blue_size == 8) && (blue_offset = 24)
-       && (alpha_size == 8) && (alpha_offset = 0))
-    {
-        return G2D_FMT_BGRA_VUYA8888;
-    }
-    else if((red_size == 8) && (red_offset = 24)
-       && (green_size == 8) && (green_offset = 16)
-       && (blue_size == 8) && (blue_offset = 8)
-       && (alpha_size == 8) && (alpha_offset = 0))
-    {
-        return G2D_FMT_RGBA_YUVA8888;
-    }
-    else if((red_size == 8) && (red_offset = 16)
-       && (green_size == 8) && (green_offset = 8)
-       && (blue_size == 8) && (blue_offset = 0)
-       && (alpha_size == 0) && (alpha_offset = 24))
-    {
-        return G2D_FMT_XRGB8888;
-    }
-    else if((red_size == 8) && (red_offset = 8)
-       && (green_size == 8) && (green_offset = 16)
-       && (blue_size == 8) && (blue_offset = 24)
-       && (alpha_size == 0) && (alpha_offset = 0))
-    {
-        return G2D_FMT_BGRX8888;
-    }
-    else if((red_size == 8) && (red_offset = 0)
-       && (green_size == 8) && (green_offset = 8)
-       && (blue_size == 8) && (blue_offset = 16)
-       && (alpha_size == 0) && (alpha_offset = 24))
-    {
-        return G2D_FMT_XBGR8888;
-    }
-    else if((red_size == 8) && (red_offset = 24)
-       && (green_size == 8) && (green_offset = 16)
-       && (blue_size == 8) && (blue_offset = 8)
-       && (alpha_size == 0) && (alpha_offset = 0))
-    {
-        return G2D_FMT_RGBX8888;
-    }
-    else if((red_size == 5) && (red_offset = 11)
-       && (green_size == 6) && (green_offset = 5)
-       && (blue_size == 5) && (blue_offset = 0))
-    {
-        return G2D_FMT_RGB565;
-    }
-    else if((red_size == 5) && (red_offset = 0)
-       && (green_size == 6) && (green_offset = 5)
-       && (blue_size == 5) && (blue_offset = 11))
-    {
-        return G2D_FMT_BGR565;
-    }
-    else 
-    {
-        return G2D_FMT_RGBA_YUVA8888;
-    }
-}
-      
 /*
 **********************************************************************************************************************
-*                                               display_copyfb
+*                                               display_openfb
 *
-* author:           
-*
-* date:             2011-7-17:11:22:54
-*
-* Description:      copy from src fb to dst fb 
+* Description:      open /dev/graphics/fbN once, keep it open for the life of the device 
 *
 * parameters:       
 *
-* return:           if success return GUI_RET_OK
-*                   if fail return the number of fail
+* return:           the fd, or -1 if it can't be opened
 * modify history: 
 **********************************************************************************************************************
 */
 
-static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
-                          int dstfb_id,int dstfb_bufno)
+static int display_openfb(struct display_context_t* ctx,int fb_id)
 {
-    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
-    
-	struct fb_fix_screeninfo    fix_src;
-    struct fb_fix_screeninfo    fix_dst;
-    struct fb_var_screeninfo    var_src;
-    struct fb_var_screeninfo    var_dst;
-    char               			node_src[20];
-    char               			node_dst[20];
-    unsigned int                src_width;
-    unsigned int                src_height;
-    unsigned int                dst_width;
-    unsigned int                dst_height;
-    unsigned int                addr_src;
-    unsigned int                addr_dst;
-    unsigned int                size;
-    g2d_stretchblt              blit_para;
-    int                         err;
-    
-    sprintf(node_src, "/dev/graphics/fb%d", srcfb_id);
+    char                        node[20];
+    int                         fd;
 
-    if(ctx->mFD_fb[srcfb_id] == 0)
+    pthread_mutex_lock(&ctx->mCacheLock);
+    if(ctx->mFD_fb[fb_id] == 0)
     {
-    	ctx->mFD_fb[srcfb_id]			= open(node_src,O_RDWR,0);
-    	if(ctx->mFD_fb[srcfb_id] <= 0)
+        sprintf(node, "/dev/graphics/fb%d", fb_id);
+
+    	ctx->mFD_fb[fb_id]			= open(node,O_RDWR,0);
+    	if(ctx->mFD_fb[fb_id] <= 0)
     	{
-    		LOGE("open fb%d fail!\n",srcfb_id);
+    		LOGE("open fb%d fail!\n",fb_id);
     		
-    		ctx->mFD_fb[srcfb_id]		= 0;
+    		ctx->mFD_fb[fb_id]		= 0;
+    		pthread_mutex_unlock(&ctx->mCacheLock);
     		
     		return  -1;
     	}
 	}
+    fd = ctx->mFD_fb[fb_id];
+    pthread_mutex_unlock(&ctx->mCacheLock);
+
+    return  fd;
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_getfbinfo
+*
+* Description:      fixed and var screeninfo of fb_id. var is always asked again, the rest comes from the cache
+*                   while the layout in var is unchanged 
+*
+* parameters:       called with mCacheLock held, the entry is only current until it is dropped 
+*
+* return:           the cache entry, or NULL if the fb can't be opened or queried
+* modify history: 
+**********************************************************************************************************************
+*/
 
-    sprintf(node_dst, "/dev/graphics/fb%d", dstfb_id);
+static struct display_fbinfo_t* display_getfbinfo(struct display_context_t* ctx,int fb_id)
+{
+    struct display_fbinfo_t*    info = &ctx->mFbInfo[fb_id];
+    struct fb_var_screeninfo    var;
+    int                         fd;
 
-    if(ctx->mFD_fb[dstfb_id] == 0)
+    fd = display_openfb(ctx,fb_id);
+    if(fd < 0)
     {
-    	ctx->mFD_fb[dstfb_id]			= open(node_dst,O_RDWR,0);
-    	if(ctx->mFD_fb[dstfb_id] <= 0)
-    	{
-    		LOGE("open fb%d fail!\n",dstfb_id);
-    		
-    		ctx->mFD_fb[dstfb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
+        return  NULL;
+    }
 
-    if(ctx->mFD_mp == 0)
+    // gralloc may have put a new mode since we last looked
+    if(ioctl(fd,FBIOGET_VSCREENINFO,&var) < 0)
     {
-        ctx->mFD_mp                     = open("/dev/g2d", O_RDWR, 0);
-        if(ctx->mFD_mp < 0)
-        {
-            LOGE("open g2d driver fail!\n");
-    		
-    		ctx->mFD_mp		= 0;
+        LOGE("get var screeninfo of fb%d fail!\n",fb_id);
+        info->valid = false;
 
-            return -1;
-        }
+        return  NULL;
     }
-    
-	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_FSCREENINFO,&fix_src);
-	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_VSCREENINFO,&var_src);
-	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_FSCREENINFO,&fix_dst);
-	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_VSCREENINFO,&var_dst);
-	
-	src_width   = var_src.xres;
-	src_height  = var_src.yres;
-    dst_width   = var_dst.xres;
-    dst_height  = var_dst.yres;
-    
-    //LOGD("src_width = %d\n",src_width);
-    //LOGD("src_height = %d\n",src_height);
-    //LOGD("dst_width = %d\n",dst_width);
-    //LOGD("dst_height = %d\n",dst_height);
-    
-	addr_src = fix_src.smem_start + ((var_src.xres * (srcfb_bufno * var_src.yres) * var_src.bits_per_pixel) >> 3);
-	addr_dst = fix_dst.smem_start + ((var_dst.xres * (dstfb_bufno * var_dst.yres) * var_dst.bits_per_pixel) >> 3);
-	size = (var_src.xres * var_src.yres * var_src.bits_per_pixel) >> 3;//in byte unit
-	
-	//LOGD("addr_src = %x\n",addr_src);
-    //LOGD("addr_dst = %x\n",addr_dst);
-    //LOGD("size = %d\n",size);
-	switch (var_src.bits_per_pixel) 
-	{			
-    	case 16:
-    		blit_para.src_image.format      = G2D_FMT_RGB565;
-    		break;
-    		
-    	case 24:
-    		blit_para.src_image.format      = G2D_FMT_RGBA_YUVA8888;
-    		break;
-    		
-    	case 32:
-    		blit_para.src_image.format      = G2D_FMT_RGBA_YUVA8888;
-    		break;
-    		
-    	default:
-    	    LOGE("invalid bits_per_pixel :%d\n", var_src.bits_per_pixel);
-    		return -1;
-	}
 
-    blit_para.src_image.addr[0]     = addr_src;
-    blit_para.src_image.addr[1]     = 0;
-    blit_para.src_image.addr[2]     = 0;
-    blit_para.src_image.format      = G2D_FMT_ARGB_AYUV8888;
-    blit_para.src_image.h           = src_height;
-    blit_para.src_image.w           = src_width;
-    blit_para.src_image.pixel_seq   = G2D_SEQ_VYUY;
-
-    blit_para.dst_image.addr[0]     = addr_dst;
-    blit_para.dst_image.addr[1]     = 0;
-    blit_para.dst_image.addr[2]     = 0;
-    blit_para.dst_image.format      = G2D_FMT_ARGB_AYUV8888;
-    blit_para.dst_image.h           = dst_height;
-    blit_para.dst_image.w           = dst_width;
-    blit_para.dst_image.pixel_seq   = G2D_SEQ_VYUY;
-
-    //blit_para.dst_x                 = 0;
-    //blit_para.dst_y                 = 0;
-    blit_para.dst_rect.x            = 0;
-    blit_para.dst_rect.y            = 0;
-    blit_para.dst_rect.w            = dst_width;
-    blit_para.dst_rect.h            = dst_height;
-
-    blit_para.src_rect.x            = 0;
-    blit_para.src_rect.y            = 0;
-    blit_para.src_rect.w            = src_width;
-    blit_para.src_rect.h            = src_height;
-
-    blit_para.flag                 = G2D_BLT_NONE;
-			
-    err = ioctl(ctx->mFD_mp , G2D_CMD_STRETCHBLT ,(unsigned long)&blit_para);				
-    if(err < 0)		
-    {    
-        LOGE("copy fb failed!\n");
-        
-        return  -1;      
+    if(!info->valid
+       || var.xres != info->var.xres || var.yres != info->var.yres
+       || var.xres_virtual != info->var.xres_virtual || var.yres_virtual != info->var.yres_virtual
+       || var.bits_per_pixel != info->var.bits_per_pixel)
+    {
+        struct fb_fix_screeninfo    fix;
+
+        if(ioctl(fd,FBIOGET_FSCREENINFO,&fix) < 0)
+        {
+            LOGE("get fix screeninfo of fb%d fail!\n",fb_id);
+            info->valid = false;
+
+            return  NULL;
+        }
+        if(info->base && (fix.smem_start != info->fix.smem_start || fix.smem_len != info->mapsize))
+        {
+            munmap(info->base,info->mapsize);
+            info->base      = NULL;
+            info->mapsize   = 0;
+        }
+        info->fix   = fix;
     }
+    info->var   = var;
+    info->valid = true;
 
-    return  0;
+    return  info;
 }
 
 /*
 **********************************************************************************************************************
-*                                               display_copyfb
+*                                               display_getlayerhdl
 *
-* author:           
-*
-* date:             2011-7-17:11:22:54
-*
-* Description:      copy from src fb to dst fb 
+* Description:      layer handle of fb_id on screen, from the cache when it is current 
 *
 * parameters:       
 *
-* return:           if success return GUI_RET_OK
-*                   if fail return the number of fail
+* return:           the layer handle, 0 if the fb can't be opened
 * modify history: 
 **********************************************************************************************************************
 */
 
-static int display_copyfbsoft(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
-                          int dstfb_id,int dstfb_bufno)
+static unsigned long display_getlayerhdl(struct display_context_t* ctx,int fb_id,int screen)
 {
-    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
-    
-	struct fb_fix_screeninfo    fix_src;
-    struct fb_fix_screeninfo    fix_dst;
-    struct fb_var_screeninfo    var_src;
-    struct fb_var_screeninfo    var_dst;
-    char               			node_src[20];
-    char               			node_dst[20];
-    unsigned int                src_width;
-    unsigned int                src_height;
-    unsigned int                dst_width;
-    unsigned int                dst_height;
-    unsigned int                addr_src;
-    unsigned int                addr_dst;
-    unsigned int                size;
-    g2d_stretchblt              blit_para;
-    int                         err;
-    
-    sprintf(node_src, "/dev/graphics/fb%d", srcfb_id);
+    struct display_fbinfo_t*    info = &ctx->mFbInfo[fb_id];
+    unsigned long               hdl;
+    int                         fd;
 
-    if(ctx->mFD_fb[srcfb_id] == 0)
+    pthread_mutex_lock(&ctx->mCacheLock);
+    if(!(info->layermask & (1 << screen)))
     {
-    	ctx->mFD_fb[srcfb_id]			= open(node_src,O_RDWR,0);
-    	if(ctx->mFD_fb[srcfb_id] <= 0)
-    	{
-    		LOGE("open fb%d fail!\n",srcfb_id);
-    		
-    		ctx->mFD_fb[srcfb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
+        fd = display_openfb(ctx,fb_id);
+        if(fd < 0)
+        {
+            pthread_mutex_unlock(&ctx->mCacheLock);
+
+            return  0;
+        }
+
+        ioctl(fd,screen ? FBIOGET_LAYER_HDL_1 : FBIOGET_LAYER_HDL_0,&info->layer_hdl[screen]);
+        info->layermask |= 1 << screen;
+    }
+    hdl = info->layer_hdl[screen];
+    pthread_mutex_unlock(&ctx->mCacheLock);
 
-    sprintf(node_dst, "/dev/graphics/fb%d", dstfb_id);
+    return  hdl;
+}
+
+/* the driver is about to change fb_id, forget what we knew about it */
+static void display_invalidatefb(struct display_context_t* ctx,int fb_id)
+{
+    struct display_fbinfo_t*    info = &ctx->mFbInfo[fb_id];
 
-    if(ctx->mFD_fb[dstfb_id] == 0)
+    pthread_mutex_lock(&ctx->mCacheLock);
+    info->valid       = false;
+    info->layermask   = 0;
+    if(info->base)
     {
-    	ctx->mFD_fb[dstfb_id]			= open(node_dst,O_RDWR,0);
-    	if(ctx->mFD_fb[dstfb_id] <= 0)
-    	{
-    		LOGE("open fb%d fail!\n",dstfb_id);
-    		
-    		ctx->mFD_fb[dstfb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
+        munmap(info->base,info->mapsize);
+        info->base    = NULL;
+        info->mapsize = 0;
+    }
+    pthread_mutex_unlock(&ctx->mCacheLock);
+}
+
+/* fb_id mapped into our address space, NULL if it can't be. called with mCacheLock held, like getfbinfo */
+static struct display_fbinfo_t* display_mapfb(struct display_context_t* ctx,int fb_id)
+{
+    struct display_fbinfo_t*    info;
+    void*                       base;
+
+    info = display_getfbinfo(ctx,fb_id);
+    if(!info)
+    {
+        return  NULL;
+    }
+
+    if(!info->base)
+    {
+        base = mmap(NULL,info->fix.smem_len,PROT_READ | PROT_WRITE,MAP_SHARED,ctx->mFD_fb[fb_id],0);
+        if(base == MAP_FAILED)
+        {
+            LOGE("mmap fb%d fail!\n",fb_id);
+
+            return  NULL;
+        }
+        info->base      = base;
+        info->mapsize   = info->fix.smem_len;
+    }
+
+    return  info;
+}
+
+/* the g2d fd, -1 once it turned out there is none */
+static int display_openg2d(struct display_context_t* ctx)
+{
+    int                         fd;
+
+    pthread_mutex_lock(&ctx->mCacheLock);
+    if(ctx->mFD_mp == 0)
+    {
+        ctx->mFD_mp                     = open("/dev/g2d", O_RDWR, 0);
+        if(ctx->mFD_mp < 0)
+        {
+            LOGE("open g2d driver fail, copying in software!\n");
+    		
+    		ctx->mFD_mp		= -1;
+        }
+    }
+    fd = ctx->mFD_mp;
+    pthread_mutex_unlock(&ctx->mCacheLock);
+
+    return  fd;
+}
+
+static struct display_workers_t* display_getworkers(struct display_context_t* ctx)
+{
+    struct display_workers_t*   workers;
+
+    pthread_mutex_lock(&ctx->mCacheLock);
+    if(!ctx->mWorkers)
+    {
+        ctx->mWorkers = display_workers_create(0);
+    }
+    workers = ctx->mWorkers;
+    pthread_mutex_unlock(&ctx->mCacheLock);
+
+    return  workers;
+}
+
+static int get_g2dpixelformat(int red_size,int red_offset,
+                              int green_size,int green_offset,
+                              int blue_size,int blue_offset,
+                              int alpha_size,int alpha_offset)
+{
+    if((red_size == 8) && (red_offset == 0)
+       && (green_size == 8) && (green_offset == 8)
+       && (blue_size == 8) && (blue_offset == 16)
+       && (alpha_size == 8) && (alpha_offset == 24))
+    {
+        return G2D_FMT_ABGR_AVUY8888;
+    }
+    else if((red_size == 8) && (red_offset == 16)
+       && (green_size == 8) && (green_offset == 8)
+       && (blue_size == 8) && (blue_offset == 0)
+       && (alpha_size == 8) && (alpha_offset == 24))
+    {
+        return G2D_FMT_ARGB_AYUV8888;
+    }
+    else if((red_size == 8) && (red_offset == 8)
+       && (green_size == 8) && (green_offset == 16)
+       && (blue_size == 8) && (blue_offset == 24)
+       && (alpha_size == 8) && (alpha_offset == 0))
+    {
+        return G2D_FMT_BGRA_VUYA8888;
+    }
+    else if((red_size == 8) && (red_offset == 24)
+       && (green_size == 8) && (green_offset == 16)
+       && (blue_size == 8) && (blue_offset == 8)
+       && (alpha_size == 8) && (alpha_offset == 0))
+    {
+        return G2D_FMT_RGBA_YUVA8888;
+    }
+    else if((red_size == 8) && (red_offset == 16)
+       && (green_size == 8) && (green_offset == 8)
+       && (blue_size == 8) && (blue_offset == 0)
+       && (alpha_size == 0))
+    {
+        return G2D_FMT_XRGB8888;
+    }
+    else if((red_size == 8) && (red_offset == 8)
+       && (green_size == 8) && (green_offset == 16)
+       && (blue_size == 8) && (blue_offset == 24)
+       && (alpha_size == 0))
+    {
+        return G2D_FMT_BGRX8888;
+    }
+    else if((red_size == 8) && (red_offset == 0)
+       && (green_size == 8) && (green_offset == 8)
+       && (blue_size == 8) && (blue_offset == 16)
+       && (alpha_size == 0))
+    {
+        return G2D_FMT_XBGR8888;
+    }
+    else if((red_size == 8) && (red_offset == 24)
+       && (green_size == 8) && (green_offset == 16)
+       && (blue_size == 8) && (blue_offset == 8)
+       && (alpha_size == 0))
+    {
+        return G2D_FMT_RGBX8888;
+    }
+    else if((red_size == 5) && (red_offset == 11)
+       && (green_size == 6) && (green_offset == 5)
+       && (blue_size == 5) && (blue_offset == 0))
+    {
+        return G2D_FMT_RGB565;
+    }
+    else if((red_size == 5) && (red_offset == 0)
+       && (green_size == 6) && (green_offset == 5)
+       && (blue_size == 5) && (blue_offset == 11))
+    {
+        return G2D_FMT_BGR565;
+    }
+    else 
+    {
+        return -1;
+    }
+}
+
+/* g2d format of a framebuffer, from its bitfields. -1 if the g2d has none */
+static int display_getg2dformat(struct display_fbinfo_t* info)
+{
+    const struct fb_var_screeninfo* var = &info->var;
+    int                         format;
+    unsigned int                bpp;
+
+    format = get_g2dpixelformat(var->red.length,var->red.offset,
+                                var->green.length,var->green.offset,
+                                var->blue.length,var->blue.offset,
+                                var->transp.length,var->transp.offset);
+    if(format < 0)
+    {
+        return  -1;
+    }
+
+    // the bitfields alone also match a 24 bit fb, which no g2d format packs
+    bpp = (format == G2D_FMT_RGB565 || format == G2D_FMT_BGR565) ? 16 : 32;
+    if(var->bits_per_pixel != bpp)
+    {
+        return  -1;
+    }
+
+    return  format;
+}
+      
+static int display_gcd(int a,int b)
+{
+    while(b)
+    {
+        int t = a % b;
+
+        a = b;
+        b = t;
+    }
+
+    return  a;
+}
+
+/*
+ * Map [start, end) of a source axis of srcsize pixels onto an axis of
+ * dstsize pixels. The span is padded by the reach of the scaling filter,
+ * so that the pixels next to a change are filtered from the new content,
+ * then widened to a multiple of srcsize / gcd: at those positions source
+ * and destination line up exactly, and the blit samples the same source
+ * positions the full frame would.
+ */
+static void display_mapspan(int start,int end,int srcsize,int dstsize,
+                            int *srcstart,int *srcend,int *dststart,int *dstend)
+{
+    int                         g;
+    int                         p;
+    int                         q;
+    int                         pad;
+
+    g   = display_gcd(srcsize,dstsize);
+    p   = srcsize / g;
+    q   = dstsize / g;
+    pad = srcsize / dstsize + 2;
+
+    start   = start - pad;
+    end     = end + pad;
+    if(start < 0)
+    {
+        start = 0;
+    }
+    if(end > srcsize)
+    {
+        end = srcsize;
+    }
+
+    start   = start / p;
+    end     = (end + p - 1) / p;
+
+    *srcstart   = start * p;
+    *srcend     = end * p;
+    *dststart   = start * q;
+    *dstend     = end * q;
+}
+
+/* bufno of info as a display_scale surface, false for a depth it can't do */
+static bool display_getsurface(struct display_fbinfo_t* info,int bufno,struct display_surface_t* surface)
+{
+    switch(info->var.bits_per_pixel)
+    {
+        case 16:
+            surface->format = (info->var.red.offset == 0) ? DISPLAY_SCALE_BGR565 : DISPLAY_SCALE_RGB565;
+            break;
+
+        case 32:
+            surface->format = (info->var.red.offset == 0) ? DISPLAY_SCALE_RGBA8888 : DISPLAY_SCALE_BGRA8888;
+            break;
+
+        default:
+            return  false;
+    }
+
+    surface->stride = info->fix.line_length;
+    surface->width  = info->var.xres;
+    surface->height = info->var.yres;
+    surface->base   = (uint8_t*)info->base + bufno * info->var.yres * info->fix.line_length;
+
+    return  true;
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_copyfbsoft
+*
+* Description:      display_copyfbrects on the cpu, through the mmapped fbs. used when there is no g2d or it fails 
+*
+* parameters:       called with mCacheLock held, so the mappings stay put 
+*
+* return:           if success return GUI_RET_OK
+*                   if fail return the number of fail
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int display_copyfbsoft(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                              int dstfb_id,int dstfb_bufno,
+                              const struct display_rect_t *rects,int count)
+{
+    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
+    struct display_fbinfo_t*    src;
+    struct display_fbinfo_t*    dst;
+    struct display_surface_t    src_surface;
+    struct display_surface_t    dst_surface;
+    struct display_rect_t       dst_rect;
+    int                         x0, x1, y0, y1;
+    int                         dx0, dx1, dy0, dy1;
+    int                         i;
+
+    src = display_mapfb(ctx,srcfb_id);
+    dst = display_mapfb(ctx,dstfb_id);
+    if(!src || !dst)
+    {
+        return  -1;
+    }
+
+    if(!display_getsurface(src,srcfb_bufno,&src_surface)
+       || !display_getsurface(dst,dstfb_bufno,&dst_surface))
+    {
+        LOGE("invalid bits_per_pixel :%d -> %d\n", src->var.bits_per_pixel, dst->var.bits_per_pixel);
+
+        return  -1;
+    }
+
+    if(rects == NULL || count < 0)
+    {
+        return  display_scale(display_getworkers(ctx),&dst_surface,&src_surface,NULL,ctx->mSoftFilter);
+    }
+
+    for(i = 0;i < count;i++)
+    {
+        if(rects[i].width <= 0 || rects[i].height <= 0)
+        {
+            continue;
+        }
+
+        display_mapspan(rects[i].x,rects[i].x + rects[i].width,src_surface.width,dst_surface.width,&x0,&x1,&dx0,&dx1);
+        display_mapspan(rects[i].y,rects[i].y + rects[i].height,src_surface.height,dst_surface.height,&y0,&y1,&dy0,&dy1);
+        dst_rect.x      = dx0;
+        dst_rect.y      = dy0;
+        dst_rect.width  = dx1 - dx0;
+        dst_rect.height = dy1 - dy0;
+        if(display_scale(display_getworkers(ctx),&dst_surface,&src_surface,&dst_rect,ctx->mSoftFilter) < 0)
+        {
+            return  -1;
+        }
+    }
+
+    return  0;
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_copyfbg2d
+*
+* Description:      display_copyfbrects with the g2d, in software when there is none or it fails 
+*
+* parameters:       called with mCacheLock held 
+*
+* return:           if success return GUI_RET_OK
+*                   if fail return the number of fail
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int display_copyfbg2d(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                             int dstfb_id,int dstfb_bufno,
+                             const struct display_rect_t *rects,int count)
+{
+    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
     
-	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_FSCREENINFO,&fix_src);
-	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_VSCREENINFO,&var_src);
-	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_FSCREENINFO,&fix_dst);
-	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_VSCREENINFO,&var_dst);
-	
-	src_width   = var_src.xres;
-	src_height  = var_src.yres;
-    dst_width   = var_dst.xres;
-    dst_height  = var_dst.yres;
+    struct display_fbinfo_t*    src;
+    struct display_fbinfo_t*    dst;
+    unsigned int                src_width;
+    unsigned int                src_height;
+    unsigned int                dst_width;
+    unsigned int                dst_height;
+    unsigned int                addr_src;
+    unsigned int                addr_dst;
+    unsigned int                size;
+    struct display_g2dbatch_t   batch;
+    int                         src_format;
+    int                         dst_format;
+    g2d_rect                    src_rect;
+    g2d_rect                    dst_rect;
+    int                         src_image;
+    int                         dst_image;
+    struct display_rect_t       full;
+    int                         x0;
+    int                         x1;
+    int                         y0;
+    int                         y1;
+    int                         dx0;
+    int                         dx1;
+    int                         dy0;
+    int                         dy1;
+    int                         i;
+    
+    src = display_getfbinfo(ctx,srcfb_id);
+    dst = display_getfbinfo(ctx,dstfb_id);
+    if(!src || !dst)
+    {
+        return  -1;
+    }
+
+    if(ctx->mSoftOnly || display_openg2d(ctx) < 0)
+    {
+        return  display_copyfbsoft(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno,rects,count);
+    }
+    
+	src_width   = src->var.xres;
+	src_height  = src->var.yres;
+    dst_width   = dst->var.xres;
+    dst_height  = dst->var.yres;
     
     //LOGD("src_width = %d\n",src_width);
     //LOGD("src_height = %d\n",src_height);
     //LOGD("dst_width = %d\n",dst_width);
     //LOGD("dst_height = %d\n",dst_height);
     
-	addr_src = fix_src.smem_start + ((var_src.xres * (srcfb_bufno * var_src.yres) * var_src.bits_per_pixel) >> 3);
-	addr_dst = fix_dst.smem_start + ((var_dst.xres * (dstfb_bufno * var_dst.yres) * var_dst.bits_per_pixel) >> 3);
-	size = (var_src.xres * var_src.yres * var_src.bits_per_pixel) >> 3;//in byte unit
+	addr_src = src->fix.smem_start + ((src->var.xres * (srcfb_bufno * src->var.yres) * src->var.bits_per_pixel) >> 3);
+	addr_dst = dst->fix.smem_start + ((dst->var.xres * (dstfb_bufno * dst->var.yres) * dst->var.bits_per_pixel) >> 3);
+	size = (src->var.xres * src->var.yres * src->var.bits_per_pixel) >> 3;//in byte unit
 	
 	//LOGD("addr_src = %x\n",addr_src);
     //LOGD("addr_dst = %x\n",addr_dst);
     //LOGD("size = %d\n",size);
-	switch (var_src.bits_per_pixel) 
-	{			
-    	case 16:
-    		blit_para.src_image.format      = G2D_FMT_RGB565;
-    		break;
-    		
-    	case 24:
-    		blit_para.src_image.format      = G2D_FMT_RGBA_YUVA8888;
-    		break;
-    		
-    	case 32:
-    		blit_para.src_image.format      = G2D_FMT_RGBA_YUVA8888;
-    		break;
-    		
-    	default:
-    	    LOGE("invalid bits_per_pixel :%d\n", var_src.bits_per_pixel);
-    		return -1;
-	}
+    // the g2d converts between the two on the way
+    src_format = display_getg2dformat(src);
+    dst_format = display_getg2dformat(dst);
+    if(src_format < 0 || dst_format < 0)
+    {
+        LOGE("no g2d format for fb%d (%d bpp) or fb%d (%d bpp)\n",
+             srcfb_id, src->var.bits_per_pixel, dstfb_id, dst->var.bits_per_pixel);
 
-    blit_para.src_image.addr[0]     = addr_src;
-    blit_para.src_image.addr[1]     = 0;
-    blit_para.src_image.addr[2]     = 0;
-    blit_para.src_image.format      = G2D_FMT_ARGB_AYUV8888;
-    blit_para.src_image.h           = src_height;
-    blit_para.src_image.w           = src_width;
-    blit_para.src_image.pixel_seq   = G2D_SEQ_VYUY;
-
-    blit_para.dst_image.addr[0]     = addr_dst;
-    blit_para.dst_image.addr[1]     = 0;
-    blit_para.dst_image.addr[2]     = 0;
-    blit_para.dst_image.format      = G2D_FMT_ARGB_AYUV8888;
-    blit_para.dst_image.h           = dst_height;
-    blit_para.dst_image.w           = dst_width;
-    blit_para.dst_image.pixel_seq   = G2D_SEQ_VYUY;
-
-    //blit_para.dst_x                 = 0;
-    //blit_para.dst_y                 = 0;
-    blit_para.dst_rect.x            = 0;
-    blit_para.dst_rect.y            = 0;
-    blit_para.dst_rect.w            = dst_width;
-    blit_para.dst_rect.h            = dst_height;
-
-    blit_para.src_rect.x            = 0;
-    blit_para.src_rect.y            = 0;
-    blit_para.src_rect.w            = src_width;
-    blit_para.src_rect.h            = src_height;
-
-    blit_para.flag                 = G2D_BLT_NONE;
-			
-    err = ioctl(ctx->mFD_mp , G2D_CMD_STRETCHBLT ,(unsigned long)&blit_para);			
-    if(err < 0)		
+        return  display_copyfbsoft(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno,rects,count);
+    }
+
+    display_g2d_begin(&batch,ctx->mFD_mp,&ctx->mG2dStats);
+    src_image = display_g2d_image(&batch,addr_src,src_width,src_height,(g2d_data_fmt)src_format);
+    dst_image = display_g2d_image(&batch,addr_dst,dst_width,dst_height,(g2d_data_fmt)dst_format);
+
+    if(rects == NULL || count < 0)
+    {
+        full.x      = 0;
+        full.y      = 0;
+        full.width  = src_width;
+        full.height = src_height;
+        rects       = &full;
+        count       = 1;
+    }
+
+    for(i = 0;i < count;i++)
+    {
+        if(rects[i].width <= 0 || rects[i].height <= 0)
+        {
+            continue;
+        }
+
+        if(rects == &full)
+        {
+            x0 = 0;  x1 = src_width;   dx0 = 0;  dx1 = dst_width;
+            y0 = 0;  y1 = src_height;  dy0 = 0;  dy1 = dst_height;
+        }
+        else
+        {
+            display_mapspan(rects[i].x,rects[i].x + rects[i].width,src_width,dst_width,&x0,&x1,&dx0,&dx1);
+            display_mapspan(rects[i].y,rects[i].y + rects[i].height,src_height,dst_height,&y0,&y1,&dy0,&dy1);
+            if(x1 <= x0 || y1 <= y0)
+            {
+                continue;
+            }
+        }
+
+        dst_rect.x          = dx0;
+        dst_rect.y          = dy0;
+        dst_rect.w          = dx1 - dx0;
+        dst_rect.h          = dy1 - dy0;
+
+        src_rect.x          = x0;
+        src_rect.y          = y0;
+        src_rect.w          = x1 - x0;
+        src_rect.h          = y1 - y0;
+
+        display_g2d_blit(&batch,src_image,&src_rect,dst_image,&dst_rect);
+    }
+
+    if(display_g2d_submit(&batch) < 0)
     {    
-        LOGE("copy fb failed!\n");
+        LOGE("copy fb failed, retrying in software!\n");
         
-        return  -1;      
+        return  display_copyfbsoft(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno,rects,count);
     }
 
     return  0;
 }
-      
+
 /*
 **********************************************************************************************************************
-*                                               display_pandisplay
-*
-* author:           
-*
-* date:             2011-7-17:11:22:58
+*                                               display_copyfbrects
 *
-* Description:      FB numΪfb_idbufnoʾ 
+* Description:      copy the given rects of src fb, scaled, to dst fb. rects == NULL or count < 0 copies the whole fb 
 *
 * parameters:       
 *
@@ -955,44 +1390,30 @@ static int display_copyfbsoft(struct display_device_t *dev,int srcfb_id,int srcf
 **********************************************************************************************************************
 */
 
-static int display_pandisplay(struct display_device_t *dev,int fb_id,int bufno)
+static int display_copyfbrects(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                               int dstfb_id,int dstfb_bufno,
+                               const struct display_rect_t *rects,int count)
 {
     struct 	display_context_t*  ctx = (struct display_context_t*)dev;
-    struct fb_var_screeninfo    var;
-    char               node[20];
-    
-    sprintf(node, "/dev/graphics/fb%d", fb_id);
-    
-    if(ctx->mFD_fb[fb_id] == 0)
-    {
-    	ctx->mFD_fb[fb_id]			= open(node,O_RDWR,0);
-    	if(ctx->mFD_fb[fb_id] <= 0)
-    	{
-    		LOGE("open fb%d fail!\n",fb_id);
-    		
-    		ctx->mFD_fb[fb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
-		
-	ioctl(ctx->mFD_fb[fb_id],FBIOGET_VSCREENINFO,&var);
-	var.yoffset = bufno * var.yres;
-	//LOGD("fb_id = %d,var.yoffset = %d\n",fb_id,var.yoffset);
-	ioctl(ctx->mFD_fb[fb_id],FBIOPAN_DISPLAY,&var);
+    int                         ret;
 
-    return 0;
+    // the geometry and mappings must not change under the copy
+    pthread_mutex_lock(&ctx->mCacheLock);
+    ret = display_copyfbg2d(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno,rects,count);
+    pthread_mutex_unlock(&ctx->mCacheLock);
+
+    return  ret;
 }
-      
+
 /*
 **********************************************************************************************************************
-*                                               get_tvformat
+*                                               display_copyfb
 *
 * author:           
 *
-* date:             2011-7-17:11:23:17
+* date:             2011-7-17:11:22:54
 *
-* Description:      convert DISPLAY_FORMAT to DRIVER format 
+* Description:      copy from src fb to dst fb 
 *
 * parameters:       
 *
@@ -1002,7 +1423,75 @@ static int display_pandisplay(struct display_device_t *dev,int fb_id,int bufno)
 **********************************************************************************************************************
 */
 
-static int get_tvformat(int format) 
+static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                          int dstfb_id,int dstfb_bufno)
+{
+    return  display_copyfbrects(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno,NULL,-1);
+}
+
+      
+/*
+**********************************************************************************************************************
+*                                               display_pandisplay
+*
+* author:           
+*
+* date:             2011-7-17:11:22:58
+*
+* Description:      FB numΪfb_idbufnoʾ 
+*
+* parameters:       
+*
+* return:           if success return GUI_RET_OK
+*                   if fail return the number of fail
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int display_pandisplay(struct display_device_t *dev,int fb_id,int bufno)
+{
+    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
+    struct display_fbinfo_t*    info;
+    struct fb_var_screeninfo    var;
+    
+    // the cache is shared with the mirror thread, pan a copy
+    pthread_mutex_lock(&ctx->mCacheLock);
+    info = display_getfbinfo(ctx,fb_id);
+    if(!info)
+    {
+        pthread_mutex_unlock(&ctx->mCacheLock);
+
+        return  -1;
+    }
+    var = info->var;
+    pthread_mutex_unlock(&ctx->mCacheLock);
+		
+	var.yoffset = bufno * var.yres;
+	//LOGD("fb_id = %d,var.yoffset = %d\n",fb_id,var.yoffset);
+	ioctl(ctx->mFD_fb[fb_id],FBIOPAN_DISPLAY,&var);
+
+    return 0;
+}
+      
+/*
+**********************************************************************************************************************
+*                                               get_tvformat
+*
+* author:           
+*
+* date:             2011-7-17:11:23:17
+*
+* Description:      convert DISPLAY_FORMAT to DRIVER format 
+*
+* parameters:       
+*
+* return:           if success return GUI_RET_OK
+*                   if fail return the number of fail
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int get_tvformat(int format) 
 {
     switch (format) 
     {
@@ -1450,22 +1939,13 @@ static int  display_getvalidheight(struct display_context_t* ctx,int displayno,i
 static int  display_releasefb(struct display_context_t* ctx,int fb_id)
 {
     unsigned long arg[4];
-    char node[20];
-
-    sprintf(node, "/dev/graphics/fb%d", fb_id);
 
-    if(ctx->mFD_fb[fb_id] == 0)
+    if(display_openfb(ctx,fb_id) < 0)
     {
-    	ctx->mFD_fb[fb_id]			= open(node,O_RDWR,0);
-    	if(ctx->mFD_fb[fb_id] <= 0)
-    	{
-    		LOGE("open fb%d fail!\n",fb_id);
-    		
-    		ctx->mFD_fb[fb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
+        return  -1;
+    }
+
+    display_invalidatefb(ctx,fb_id);
 
     arg[0] = fb_id;
     ioctl(ctx->mFD_disp,DISP_CMD_FB_RELEASE,(unsigned long)arg);
@@ -1495,9 +1975,8 @@ static int  display_requestfb(struct display_context_t* ctx,int fb_id,struct dis
 {
     __disp_fb_create_para_t 	fb_para;
     struct 						fb_var_screeninfo var;
-    struct fb_fix_screeninfo 	fix;
+    struct display_fbinfo_t*    info;
     unsigned long 				arg[4];
-    char 						node[20];
     int							ret = -1;
     int							red_size = 8;
     int							green_size = 8;
@@ -1513,20 +1992,10 @@ static int  display_requestfb(struct display_context_t* ctx,int fb_id,struct dis
     __disp_colorkey_t 			ck;
     __disp_rect_t				scn_rect;
     
-    sprintf(node, "/dev/graphics/fb%d", fb_id);
-
-    if(ctx->mFD_fb[fb_id] == 0)
+    if(display_openfb(ctx,fb_id) < 0)
     {
-    	ctx->mFD_fb[fb_id]			= open(node,O_RDWR,0);
-    	if(ctx->mFD_fb[fb_id] <= 0)
-    	{
-    		LOGE("open fb%d fail!\n",fb_id);
-    		
-    		ctx->mFD_fb[fb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
+        return  -1;
+    }
 	
 	LOGD("ctx->mFD_fb[fb_id] = %x\n",ctx->mFD_fb[fb_id]);
 
@@ -1597,6 +2066,7 @@ static int  display_requestfb(struct display_context_t* ctx,int fb_id,struct dis
     fb_para.primary_screen_id 	= 0;
     arg[0] 						= fb_id;
     arg[1] 						= (unsigned long)&fb_para;
+    display_invalidatefb(ctx,fb_id);
     ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_REQUEST,(unsigned long)arg);
     if(ret != 0)
     {
@@ -1616,8 +2086,16 @@ static int  display_requestfb(struct display_context_t* ctx,int fb_id,struct dis
 	//LOGD("blue_offset = %x\n",blue_offset);
 	//LOGD("rdisplaypara->format = %x\n",displaypara->format);
 	//LOGD("green_size = %x\n",green_size);
-    ioctl(ctx->mFD_fb[fb_id],FBIOGET_FSCREENINFO,&fix);
-    ioctl(ctx->mFD_fb[fb_id],FBIOGET_VSCREENINFO,&var);
+    pthread_mutex_lock(&ctx->mCacheLock);
+    info = display_getfbinfo(ctx,fb_id);
+    if(!info)
+    {
+        pthread_mutex_unlock(&ctx->mCacheLock);
+
+        return  -1;
+    }
+    var                     = info->var;
+    pthread_mutex_unlock(&ctx->mCacheLock);
     var.xoffset				= 0;
     var.yoffset				= 0;
     var.xres 				= displaypara->width;
@@ -1636,17 +2114,18 @@ static int  display_requestfb(struct display_context_t* ctx,int fb_id,struct dis
     var.blue.offset 		= blue_offset;
     
     ioctl(ctx->mFD_fb[fb_id],FBIOPUT_VSCREENINFO,&var);
+    // the driver may have adjusted what we asked for
+    display_invalidatefb(ctx,fb_id);
     
     if(fb_para.fb_mode == FB_MODE_SCREEN1)
     {
     	screen				= 1;
-    	ioctl(ctx->mFD_fb[fb_id],FBIOGET_LAYER_HDL_1,&fb_layer_hdl);
     }
     else
     {
     	screen				= 0;
-    	ioctl(ctx->mFD_fb[fb_id],FBIOGET_LAYER_HDL_0,&fb_layer_hdl);
     }
+    fb_layer_hdl            = display_getlayerhdl(ctx,fb_id,screen);
     
     if((displaypara->output_height != displaypara->valid_height) || (displaypara->output_width != displaypara->valid_width))
     {
@@ -1728,36 +2207,17 @@ static int  display_setfbrect(struct display_context_t* ctx,int displayno,int fb
     struct 						fb_var_screeninfo var;
     struct fb_fix_screeninfo 	fix;
     unsigned long 				arg[4];
-    char 						node[20];
-    int							ret = -1;
     unsigned long 				fb_layer_hdl;
     __disp_rect_t				scn_rect;
     
-    sprintf(node, "/dev/graphics/fb%d", fb_id);
-
-    if(ctx->mFD_fb[fb_id] == 0)
+    if(display_openfb(ctx,fb_id) < 0)
     {
-    	ctx->mFD_fb[fb_id]			= open(node,O_RDWR,0);
-    	if(ctx->mFD_fb[fb_id] <= 0)
-    	{
-    		LOGE("open fb%d fail!\n",fb_id);
-    		
-    		ctx->mFD_fb[fb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
+        return  -1;
+    }
 	
 	LOGD("ctx->mFD_fb[fb_id] = %x\n",ctx->mFD_fb[fb_id]);
     
-    if(displayno == 1)
-    {
-    	ioctl(ctx->mFD_fb[fb_id],FBIOGET_LAYER_HDL_1,&fb_layer_hdl);
-	}
-	else
-	{
-		ioctl(ctx->mFD_fb[fb_id],FBIOGET_LAYER_HDL_0,&fb_layer_hdl);
-	}
+    fb_layer_hdl            = display_getlayerhdl(ctx,fb_id,displayno == 1 ? 1 : 0);
 
 	scn_rect.x				= x;
 	scn_rect.y				= y;
@@ -1868,58 +2328,806 @@ static int  display_off(struct display_context_t* ctx,int displayno,int outputty
 	
 	return   ret;
 }
-      
+      
+/*
+**********************************************************************************************************************
+*                                               display_getminsize
+*
+* author:           
+*
+* date:             2011-7-17:11:24:1
+*
+* Description:      display getminsize 
+*
+* parameters:       
+*
+* return:           if success return GUI_RET_OK
+*                   if fail return the number of fail
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int  display_getminsize(struct display_context_t* ctx,int *min_width,int *min_height)
+{ 
+    int     i;
+    int     num;
+    
+    *min_width  = g_display[0].width;
+    num         = 0;
+    
+    for(i = 0;i < MAX_DISPLAY_NUM;i++)
+    {
+        if(g_display[i].width < (uint32_t)*min_width)
+        {
+            *min_width = g_display[i].width;
+            num = i;
+        }
+    }
+
+    *min_height = g_display[num].height;
+
+    return  0;
+}
+      
+/*
+**********************************************************************************************************************
+*                                               display_getmaxdisplayno
+*
+* author:           
+*
+* date:             2011-7-17:11:24:3
+*
+* Description:      display getmaxdisplayno 
+*
+* parameters:       
+*
+* return:           if success return GUI_RET_OK
+*                   if fail return the number of fail
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int  display_getmaxdisplayno(struct display_device_t *dev)
+{
+    int   		i;
+    uint32_t   	max_width;
+    int   		num;
+
+    pthread_mutex_lock(&mode_lock);
+    max_width   = g_display[0].width;
+    num         = 0;
+
+    for(i = 0;i < MAX_DISPLAY_NUM;i++)
+    {
+        if(g_display[i].width > max_width)
+        {
+            max_width = g_display[i].width;
+            num = i;
+        }
+    }
+    pthread_mutex_unlock(&mode_lock);
+
+    return num;
+}
+
+static int display_getdisplaybufid(struct display_device_t *dev, int displayno)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)dev;
+    struct fb_var_screeninfo    var_src;
+    unsigned int                fbid;
+
+    
+    //pthread_mutex_lock(&mode_lock);
+    
+    fbid = g_display[displayno].fb_id;
+
+    if(display_openfb(ctx,fbid) < 0)
+    {
+    	return  -1;
+    }
+
+    // not from the cache, whoever posts to this fb pans it behind our back
+    ioctl(ctx->mFD_fb[fbid],FBIOGET_VSCREENINFO,&var_src);
+
+    //pthread_mutex_unlock(&mode_lock);  
+    
+    return  var_src.yoffset/var_src.yres;
+      
+}
+
+static int64_t display_now_ns(void)
+{
+    struct timespec             t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return  int64_t(t.tv_sec) * 1000000000LL + t.tv_nsec;
+}
+
+/* one refresh of fb, from its timings, 60Hz when the driver gave none */
+static int64_t display_frameperiod(struct display_fbinfo_t* info)
+{
+    const struct fb_var_screeninfo* var = &info->var;
+    uint64_t                    total;
+
+    total = uint64_t(var->xres + var->left_margin + var->right_margin + var->hsync_len)
+            * (var->yres + var->upper_margin + var->lower_margin + var->vsync_len);
+    if(var->pixclock == 0 || total == 0)
+    {
+        return  16666667;
+    }
+
+    // pixclock is in ps
+    return  int64_t(total * var->pixclock / 1000);
+}
+
+static void display_mirror_log(struct display_mirror_t* mirror)
+{
+    LOGI("mirror: %u frames, %u dropped, %u vsyncs skipped for the mode lock, "
+         "latency avg %.2f ms, max %.2f ms, %.1f%% of the slave pixels blitted\n",
+         mirror->numFrames, mirror->numDropped, mirror->numSkipped,
+         mirror->numFrames ? mirror->latencyNs / (1e6 * mirror->numFrames) : 0.0,
+         mirror->maxLatencyNs / 1e6,
+         mirror->fullPixels ? 100.0 * mirror->blitPixels / mirror->fullPixels : 0.0);
+}
+
+static void display_damage_add(struct display_damage_t* damage,
+                               const struct display_rect_t *rects,int count)
+{
+    struct display_rect_t*      box;
+    int                         i;
+    int                         j;
+
+    if(damage->count < 0)
+    {
+        return;
+    }
+
+    if(rects == NULL || count < 0)
+    {
+        damage->count = -1;
+
+        return;
+    }
+
+    for(i = 0;i < count;i++)
+    {
+        if(rects[i].width <= 0 || rects[i].height <= 0)
+        {
+            continue;
+        }
+
+        if(damage->count == MIRROR_MAX_RECTS)
+        {
+            box = &damage->rects[0];
+            for(j = 1;j < damage->count;j++)
+            {
+                const struct display_rect_t* r = &damage->rects[j];
+                int                          x1 = box->x + box->width;
+                int                          y1 = box->y + box->height;
+
+                if(r->x + r->width > x1)    x1 = r->x + r->width;
+                if(r->y + r->height > y1)   y1 = r->y + r->height;
+                if(r->x < box->x)           box->x = r->x;
+                if(r->y < box->y)           box->y = r->y;
+                box->width  = x1 - box->x;
+                box->height = y1 - box->y;
+            }
+            damage->count = 1;
+        }
+
+        damage->rects[damage->count++] = rects[i];
+    }
+}
+
+/* slave pixels display_copyfbrects writes for damage */
+static uint64_t display_damage_pixels(struct display_damage_t* damage,
+                                      struct display_fbinfo_t* src,struct display_fbinfo_t* dst)
+{
+    uint64_t                    pixels = 0;
+    int                         x0, x1, y0, y1;
+    int                         dx0, dx1, dy0, dy1;
+    int                         i;
+
+    if(damage->count < 0)
+    {
+        return  uint64_t(dst->var.xres) * dst->var.yres;
+    }
+
+    for(i = 0;i < damage->count;i++)
+    {
+        const struct display_rect_t* r = &damage->rects[i];
+
+        display_mapspan(r->x,r->x + r->width,src->var.xres,dst->var.xres,&x0,&x1,&dx0,&dx1);
+        display_mapspan(r->y,r->y + r->height,src->var.yres,dst->var.yres,&y0,&y1,&dy0,&dy1);
+        if(dx1 > dx0 && dy1 > dy0)
+        {
+            pixels += uint64_t(dx1 - dx0) * (dy1 - dy0);
+        }
+    }
+
+    return  pixels;
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_mirror_main
+*
+* Description:      DUALSAME mirror thread 
+*
+* parameters:       
+*
+* return:           
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static void display_mirror_release(struct display_mirrorrun_t* run)
+{
+    if(android_atomic_dec(&run->refs) == 1)
+    {
+        free(run);
+    }
+}
+
+static void* display_mirror_main(void* arg)
+{
+    struct display_mirrorrun_t* run = (struct display_mirrorrun_t*)arg;
+    struct display_context_t*   ctx = run->ctx;
+    struct display_mirror_t*    mirror = &ctx->mMirror;
+    struct display_fbinfo_t*    master;
+    struct display_fbinfo_t*    slave;
+    int                         masterfb;
+    int                         slavefb;
+    int                         bufid;
+    int                         lastbuf = -1;
+    uint32_t                    lastposts = 0;
+    uint32_t                    posts;
+    int                         generation = -1;
+    int                         numbufs;
+    int                         next;
+    int                         i;
+    bool                        warned = false;
+    bool                        inplace;
+    bool                        changed;
+    bool                        settle = false;
+    struct display_damage_t     damage;
+    struct display_damage_t     lastdamage;
+    int64_t                     period = 16666667;
+    int64_t                     wake;
+    int64_t                     latency;
+    __u32                       crtc = 0;
+
+    while(!android_atomic_acquire_load(&run->stop))
+    {
+        masterfb = g_display[g_masterdisplay].fb_id;
+        if(ctx->mFD_fb[masterfb] <= 0
+           || ioctl(ctx->mFD_fb[masterfb],FBIO_WAITFORVSYNC,&crtc) < 0)
+        {
+            // no vsync from this driver, poll at the refresh rate instead
+            usleep(period / 1000);
+        }
+
+        // ctx may be gone if the wait outlasted display_mirror_stop
+        if(android_atomic_acquire_load(&run->stop))
+        {
+            break;
+        }
+
+        wake = display_now_ns();
+
+        if(pthread_mutex_trylock(&mode_lock) != 0)
+        {
+            // a mode change is in progress, leave the fbs alone
+            mirror->numSkipped++;
+            continue;
+        }
+        if(android_atomic_acquire_load(&run->stop))
+        {
+            pthread_mutex_unlock(&mode_lock);
+            break;
+        }
+
+        // master and slave are only current while the cache lock is held
+        pthread_mutex_lock(&ctx->mCacheLock);
+        masterfb    = g_display[g_masterdisplay].fb_id;
+        slavefb     = g_display[1 - g_masterdisplay].fb_id;
+        master      = display_getfbinfo(ctx,masterfb);
+        slave       = display_getfbinfo(ctx,slavefb);
+        if(g_displaymode != DISPLAY_MODE_DUALSAME || masterfb == slavefb
+           || !g_display[1 - g_masterdisplay].isopen || !master || !slave)
+        {
+            pthread_mutex_unlock(&ctx->mCacheLock);
+            pthread_mutex_unlock(&mode_lock);
+            continue;
+        }
+
+        period = display_frameperiod(master);
+        if(generation != mirror->generation)
+        {
+            generation  = mirror->generation;
+            lastbuf     = -1;
+            warned      = false;
+            settle      = false;
+
+            // the slave may have been drawn to by anyone in between
+            for(i = 0;i < MIRROR_MAX_BUFFERS;i++)
+            {
+                mirror->pending[i].count = -1;
+            }
+        }
+
+        numbufs = slave->var.yres ? slave->var.yres_virtual / slave->var.yres : 1;
+        if(numbufs > MIRROR_MAX_BUFFERS)
+        {
+            numbufs = MIRROR_MAX_BUFFERS;
+        }
+        else if(numbufs < 1)
+        {
+            numbufs = 1;
+        }
+
+        /*
+         * A master that can't flip is drawn into in place, there is no flip to wait for. Once the
+         * compositor reports damage, a vsync without any means nothing changed; until then every
+         * frame is copied. Reported damage is copied again on the next vsync, in case the master
+         * was still being drawn into the first time.
+         */
+        bufid   = display_getdisplaybufid(&ctx->device.device,g_masterdisplay);
+        inplace = master->var.yres_virtual < 2 * master->var.yres;
+        pthread_mutex_lock(&mirror->damagelock);
+        changed = inplace ? (lastbuf < 0 || mirror->damaged || mirror->numPosts == 0 || settle)
+                          : (bufid != lastbuf);
+        pthread_mutex_unlock(&mirror->damagelock);
+        if(bufid >= 0 && changed)
+        {
+            // what changed since the last frame, all of it when nobody said
+            pthread_mutex_lock(&mirror->damagelock);
+            damage.count = -1;
+            if(mirror->damaged)
+            {
+                damage = mirror->incoming;
+            }
+            else if(inplace && settle)
+            {
+                damage = lastdamage;
+            }
+            settle                  = inplace && mirror->damaged;
+            lastdamage              = damage;
+            mirror->damaged         = false;
+            mirror->incoming.count  = 0;
+            posts                   = mirror->numPosts;
+            pthread_mutex_unlock(&mirror->damagelock);
+
+            // frames reported since the last one we mirrored never made it to the slave
+            if(lastbuf >= 0 && posts - lastposts > 1)
+            {
+                mirror->numDropped += posts - lastposts - 1;
+            }
+            lastposts = posts;
+
+            for(i = 0;i < numbufs;i++)
+            {
+                display_damage_add(&mirror->pending[i],damage.rects,damage.count);
+            }
+
+            // never draw into the slave buffer being scanned out, unless there is no other
+            next = (mirror->slavebuf + 1) % numbufs;
+            if(numbufs == 1 && !warned)
+            {
+                LOGW("mirror: fb%d has a single buffer, drawing into it while it is scanned out\n",slavefb);
+                warned = true;
+            }
+            if(display_copyfbrects(&ctx->device.device,masterfb,bufid,slavefb,next,
+                                   mirror->pending[next].rects,mirror->pending[next].count) == 0)
+            {
+                mirror->blitPixels += display_damage_pixels(&mirror->pending[next],master,slave);
+                mirror->fullPixels += uint64_t(slave->var.xres) * slave->var.yres;
+                mirror->pending[next].count = 0;
+
+                if(numbufs > 1)
+                {
+                    display_pandisplay(&ctx->device.device,slavefb,next);
+                }
+                mirror->slavebuf    = next;
+                lastbuf             = bufid;
+
+                latency = display_now_ns() - wake;
+                mirror->numFrames++;
+                mirror->latencyNs  += latency;
+                if(latency > mirror->maxLatencyNs)
+                {
+                    mirror->maxLatencyNs = latency;
+                }
+            }
+            else
+            {
+                mirror->numDropped++;
+            }
+        }
+
+        pthread_mutex_unlock(&ctx->mCacheLock);
+        pthread_mutex_unlock(&mode_lock);
+
+        if(mirror->verbose && wake - mirror->lastLogNs > 10000000000LL)
+        {
+            display_mirror_log(mirror);
+            display_g2d_logstats(&ctx->mG2dStats);
+            mirror->lastLogNs = wake;
+        }
+    }
+
+    android_atomic_release_store(1,&run->exited);
+    display_mirror_release(run);
+
+    return  NULL;
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_mirror_stop
+*
+* Description:      stop the mirror thread. called with mode_lock held before the outputs are changed, while the
+*                   master still scans out, so the thread wakes from its vsync within a frame. a thread still
+*                   waiting after MIRROR_STOP_TIMEOUT is left to exit on its own, rather than hold mode_lock
+*                   for as long as the master doesn't vsync.
+*
+* parameters:       
+*
+* return:           
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static void display_mirror_stop(struct display_context_t* ctx)
+{
+    struct display_mirror_t*    mirror = &ctx->mMirror;
+    struct display_mirrorrun_t* run = mirror->run;
+    int                         waited;
+
+    if(!run)
+    {
+        return;
+    }
+
+    android_atomic_release_store(-1,&mirror->ownedfb);
+    android_atomic_release_store(1,&run->stop);
+    for(waited = 0;!android_atomic_acquire_load(&run->exited) && waited < MIRROR_STOP_TIMEOUT;waited++)
+    {
+        usleep(1000);
+    }
+
+    if(android_atomic_acquire_load(&run->exited))
+    {
+        display_mirror_log(mirror);
+        display_g2d_logstats(&ctx->mG2dStats);
+    }
+    else
+    {
+        LOGW("mirror: thread still waiting for a vsync after %d ms, leaving it behind\n",MIRROR_STOP_TIMEOUT);
+    }
+    display_mirror_release(run);
+    mirror->run = NULL;
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_mirror_update
+*
+* Description:      (re)start the mirror in DUALSAME. called with mode_lock held after every mode change, which
+*                   stops the thread before it touches the outputs. debug.display.mirror=0 leaves mirroring to
+*                   copysrcfbtodstfb callers, 2 logs the mirror's stats every 10s. 
+*
+* parameters:       
+*
+* return:           
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static void display_mirror_update(struct display_context_t* ctx)
+{
+    struct display_mirror_t*    mirror = &ctx->mMirror;
+    struct display_mirrorrun_t* run;
+    pthread_attr_t              attr;
+    pthread_t                   thread;
+    char                        value[PROPERTY_VALUE_MAX];
+
+    // whatever the thread mirrored last is stale now
+    mirror->generation++;
+
+    if(g_displaymode != DISPLAY_MODE_DUALSAME)
+    {
+        display_mirror_stop(ctx);
+
+        return;
+    }
+
+    if(mirror->run)
+    {
+        return;
+    }
+
+    property_get("debug.display.mirror", value, "1");
+    mirror->verbose = (atoi(value) > 1);
+    if(atoi(value) == 0)
+    {
+        return;
+    }
+
+    mirror->slavebuf        = 0;
+    mirror->numFrames       = 0;
+    mirror->numDropped      = 0;
+    mirror->numSkipped      = 0;
+    mirror->latencyNs       = 0;
+    mirror->maxLatencyNs    = 0;
+    mirror->blitPixels      = 0;
+    mirror->fullPixels      = 0;
+    mirror->lastLogNs       = display_now_ns();
+
+    // open and map up front, so the thread mostly finds them ready
+    if(!ctx->mSoftOnly)
+    {
+        display_openg2d(ctx);
+    }
+    display_getworkers(ctx);
+    pthread_mutex_lock(&ctx->mCacheLock);
+    display_mapfb(ctx,g_display[g_masterdisplay].fb_id);
+    display_mapfb(ctx,g_display[1 - g_masterdisplay].fb_id);
+    pthread_mutex_unlock(&ctx->mCacheLock);
+
+    run = (struct display_mirrorrun_t*)calloc(1,sizeof(*run));
+    if(!run)
+    {
+        LOGE("create mirror thread fail!\n");
+
+        return;
+    }
+    run->ctx    = ctx;
+    run->refs   = 2;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+    if(pthread_create(&thread,&attr,display_mirror_main,run) != 0)
+    {
+        LOGE("create mirror thread fail!\n");
+        pthread_attr_destroy(&attr);
+        free(run);
+
+        return;
+    }
+    pthread_attr_destroy(&attr);
+    mirror->run = run;
+    android_atomic_release_store(g_display[1 - g_masterdisplay].fb_id,&mirror->ownedfb);
+}
+
+/*
+ * copysrcfbtodstfb and pandisplay, as seen by the framework. While the
+ * mirror runs it owns the slave fb, anything else drawing to it or
+ * panning it would only fight with it. Called without mode_lock, which
+ * the framework may already hold.
+ */
+static bool display_mirrorowns(struct display_context_t* ctx,int fb_id)
+{
+    return  fb_id == android_atomic_acquire_load(&ctx->mMirror.ownedfb);
+}
+
+static int display_devcopyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                             int dstfb_id,int dstfb_bufno)
+{
+    if(display_mirrorowns((struct display_context_t*)dev,dstfb_id))
+    {
+        return  0;
+    }
+
+    return  display_copyfb(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno);
+}
+
+static int display_devpandisplay(struct display_device_t *dev,int fb_id,int bufno)
+{
+    if(display_mirrorowns((struct display_context_t*)dev,fb_id))
+    {
+        return  0;
+    }
+
+    return  display_pandisplay(dev,fb_id,bufno);
+}
+
+static int display_devcopyfbrects(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                                  int dstfb_id,int dstfb_bufno,
+                                  const struct display_rect_t *rects,int count)
+{
+    if(display_mirrorowns((struct display_context_t*)dev,dstfb_id))
+    {
+        return  0;
+    }
+
+    return  display_copyfbrects(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno,rects,count);
+}
+
+static int display_setmirrordamage(struct display_device_t *dev,
+                                   const struct display_rect_t *rects,int count)
+{
+    struct display_mirror_t*    mirror = &((struct display_context_t*)dev)->mMirror;
+
+    pthread_mutex_lock(&mirror->damagelock);
+    mirror->numPosts++;
+    if(!mirror->damaged)
+    {
+        mirror->incoming.count  = 0;
+        mirror->damaged         = true;
+    }
+    display_damage_add(&mirror->incoming,rects,count);
+    pthread_mutex_unlock(&mirror->damagelock);
+
+    return  0;
+}
+
 /*
 **********************************************************************************************************************
-*                                               display_getminsize
-*
-* author:           
-*
-* date:             2011-7-17:11:24:1
+*                                               display_hotplug_event
 *
-* Description:      display getminsize 
+* Description:      act on one uevent: a NUL separated list of KEY=value after the "action@devpath" header 
 *
 * parameters:       
 *
-* return:           if success return GUI_RET_OK
-*                   if fail return the number of fail
+* return:           
 * modify history: 
 **********************************************************************************************************************
 */
 
-static int  display_getminsize(struct display_context_t* ctx,int *min_width,int *min_height)
-{ 
-    int     i;
-    int     num;
-    
-    *min_width  = g_display[0].width;
-    num         = 0;
-    
+static void display_hotplug_event(struct display_context_t* ctx,const char* msg,int len)
+{
+    struct display_hotplug_t*   hotplug = &ctx->mHotplug;
+    const char*                 end = msg + len;
+    const char*                 subsystem = "";
+    const char*                 name = "";
+    display_hotplug_callback_t  callback;
+    void*                       cookie;
+    int                         state = -1;
+    int                         type;
+    int                         displayno = -1;
+    int                         i;
+
+    for(;msg < end;msg += strlen(msg) + 1)
+    {
+        if(!strncmp(msg,"SUBSYSTEM=",10))
+        {
+            subsystem = msg + 10;
+        }
+        else if(!strncmp(msg,"SWITCH_NAME=",12))
+        {
+            name = msg + 12;
+        }
+        else if(!strncmp(msg,"SWITCH_STATE=",13))
+        {
+            state = atoi(msg + 13);
+        }
+    }
+
+    if(strcmp(subsystem,"switch") || state < 0)
+    {
+        return;
+    }
+    if(!strcmp(name,"hdmi"))
+    {
+        type = DISPLAY_DEVICE_HDMI;
+    }
+    else if(!strncmp(name,"tv",2))
+    {
+        type = DISPLAY_DEVICE_TV;
+    }
+    else
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&mode_lock);
+    if(type == DISPLAY_DEVICE_HDMI && state != android_atomic_acquire_load(&ctx->mHdmiHpd))
+    {
+        android_atomic_release_store(state,&ctx->mHdmiHpd);
+        ctx->mHdmiProbed    = false;
+    }
     for(i = 0;i < MAX_DISPLAY_NUM;i++)
     {
-        if(g_display[i].width < (uint32_t)*min_width)
+        if((int)g_display[i].type != type)
         {
-            *min_width = g_display[i].width;
-            num = i;
+            continue;
+        }
+        if(type == DISPLAY_DEVICE_TV)
+        {
+            // the switch only says a DAC changed, plugged in is the DAC matching the tv format
+            display_gethotplug(&ctx->device.device,i);
+            state   = (g_display[i].hotplug == DISPLAY_PLUGIN) ? 1 : 0;
+        }
+        else
+        {
+            g_display[i].hotplug    = state;
         }
+        displayno   = i;
     }
+    pthread_mutex_unlock(&mode_lock);
 
-    *min_height = g_display[num].height;
+    LOGD("hotplug: %s %s\n",name,state ? "connected" : "disconnected");
 
-    return  0;
+    // not under mode_lock, the callback is free to change the mode
+    pthread_mutex_lock(&hotplug->lock);
+    callback    = hotplug->callback;
+    cookie      = hotplug->cookie;
+    pthread_mutex_unlock(&hotplug->lock);
+    if(callback)
+    {
+        callback(cookie,displayno,type,state);
+    }
 }
-      
+
+static void* display_hotplug_main(void* arg)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)arg;
+    struct display_hotplug_t*   hotplug = &ctx->mHotplug;
+    struct pollfd               fds[2];
+    char                        msg[1024 + 2];
+    int                         len;
+    int                         i;
+
+    /*
+     * the state the events will be changes to. the socket is already bound, so nothing is missed in
+     * between, and gethdmistatus still asks the driver until it is read
+     */
+    pthread_mutex_lock(&mode_lock);
+    display_gethdmistatus(&ctx->device.device);
+    for(i = 0;i < MAX_DISPLAY_NUM;i++)
+    {
+        display_gethotplug(&ctx->device.device,i);
+    }
+    pthread_mutex_unlock(&mode_lock);
+    android_atomic_release_store(1,&hotplug->live);
+
+    fds[0].fd       = hotplug->sock;
+    fds[0].events   = POLLIN;
+    fds[1].fd       = hotplug->wake[0];
+    fds[1].events   = POLLIN;
+
+    for(;;)
+    {
+        if(poll(fds,2,-1) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            LOGE("hotplug poll fail: %s\n",strerror(errno));
+            break;
+        }
+        if(fds[1].revents)
+        {
+            break;
+        }
+        if(!(fds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        len = recv(hotplug->sock,msg,sizeof(msg) - 2,0);
+        if(len <= 0)
+        {
+            continue;
+        }
+        msg[len]        = 0;
+        msg[len + 1]    = 0;
+        display_hotplug_event(ctx,msg,len);
+    }
+
+    return  NULL;
+}
+
 /*
 **********************************************************************************************************************
-*                                               display_getmaxdisplayno
-*
-* author:           
+*                                               display_hotplug_start
 *
-* date:             2011-7-17:11:24:3
-*
-* Description:      display getmaxdisplayno 
+* Description:      open the uevent socket and start the hotplug monitor, if it isn't running yet 
 *
-* parameters:       
+* parameters:       called with mHotplug.lock held, so two registrations can't both start it. takes no other lock,
+*                   the thread reads the initial state itself 
 *
 * return:           if success return GUI_RET_OK
 *                   if fail return the number of fail
@@ -1927,64 +3135,99 @@ static int  display_getminsize(struct display_context_t* ctx,int *min_width,int
 **********************************************************************************************************************
 */
 
-static int  display_getmaxdisplayno(struct display_device_t *dev)
+static int display_hotplug_start(struct display_context_t* ctx)
 {
-    int   		i;
-    uint32_t   	max_width;
-    int   		num;
+    struct display_hotplug_t*   hotplug = &ctx->mHotplug;
+    struct sockaddr_nl          addr;
+    int                         size = 64 * 1024;
 
-    pthread_mutex_lock(&mode_lock);
-    max_width   = g_display[0].width;
-    num         = 0;
+    if(hotplug->running)
+    {
+        return  0;
+    }
 
-    for(i = 0;i < MAX_DISPLAY_NUM;i++)
+    hotplug->sock = socket(PF_NETLINK,SOCK_DGRAM,NETLINK_KOBJECT_UEVENT);
+    if(hotplug->sock < 0)
     {
-        if(g_display[i].width > max_width)
-        {
-            max_width = g_display[i].width;
-            num = i;
-        }
+        LOGE("open uevent socket fail: %s\n",strerror(errno));
+
+        return  -1;
     }
-    pthread_mutex_unlock(&mode_lock);
+    setsockopt(hotplug->sock,SOL_SOCKET,SO_RCVBUFFORCE,&size,sizeof(size));
 
-    return num;
-}
+    memset(&addr,0,sizeof(addr));
+    addr.nl_family  = AF_NETLINK;
+    addr.nl_pid     = 0;            // let the kernel pick, others may listen in this process
+    addr.nl_groups  = 0xffffffff;
+    if(bind(hotplug->sock,(struct sockaddr*)&addr,sizeof(addr)) < 0)
+    {
+        LOGE("bind uevent socket fail: %s\n",strerror(errno));
+        close(hotplug->sock);
 
-static int display_getdisplaybufid(struct display_device_t *dev, int displayno)
-{
-    struct display_context_t*   ctx = (struct display_context_t*)dev;
-    struct fb_var_screeninfo    var_src;
-    char               			node_src[20];
-    unsigned int                fbid;
+        return  -1;
+    }
+    if(pipe(hotplug->wake) < 0)
+    {
+        LOGE("create hotplug wake pipe fail: %s\n",strerror(errno));
+        close(hotplug->sock);
 
-    
-    //pthread_mutex_lock(&mode_lock);
-    
-    fbid = g_display[displayno].fb_id;
+        return  -1;
+    }
+
+    android_atomic_release_store(0,&hotplug->live);
+    if(pthread_create(&hotplug->thread,NULL,display_hotplug_main,ctx) != 0)
+    {
+        LOGE("create hotplug thread fail!\n");
+        close(hotplug->wake[0]);
+        close(hotplug->wake[1]);
+        close(hotplug->sock);
+
+        return  -1;
+    }
+    hotplug->running = true;
+
+    return  0;
+}
 
-    sprintf(node_src, "/dev/graphics/fb%d", fbid);
+/* not with mode_lock held, the thread may be waiting for it */
+static void display_hotplug_stop(struct display_context_t* ctx)
+{
+    struct display_hotplug_t*   hotplug = &ctx->mHotplug;
+    char                        c = 0;
 
-    if(ctx->mFD_fb[fbid] == 0)
+    if(hotplug->running)
     {
-    	ctx->mFD_fb[fbid]			= open(node_src,O_RDWR,0);
-    	if(ctx->mFD_fb[fbid] <= 0)
-    	{
-    		LOGE("open fb%d fail!\n",fbid);
-    		
-    		ctx->mFD_fb[fbid]		= 0;
+        write(hotplug->wake[1],&c,1);
+        pthread_join(hotplug->thread,NULL);
+        android_atomic_release_store(0,&hotplug->live);
+        close(hotplug->wake[0]);
+        close(hotplug->wake[1]);
+        close(hotplug->sock);
+        hotplug->running = false;
+    }
+}
 
-            pthread_mutex_unlock(&mode_lock);  
-            
-    		return  -1;
-    	}
-	}
+/*
+ * Register the function told about every HDMI and TV plug and unplug,
+ * NULL to stop being told. Registering starts the monitor; it then runs
+ * until the device is closed, and gethdmistatus answers from it.
+ */
+static int display_sethotplugcallback(struct display_device_t *dev,
+                                      display_hotplug_callback_t callback,void *cookie)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)dev;
+    int                         ret = 0;
 
-    ioctl(ctx->mFD_fb[fbid],FBIOGET_VSCREENINFO,&var_src);
+    pthread_mutex_lock(&ctx->mHotplug.lock);
+    ctx->mHotplug.callback  = callback;
+    ctx->mHotplug.cookie    = cookie;
+    if(callback)
+    {
+        ret = display_hotplug_start(ctx);
+    }
+    pthread_mutex_unlock(&ctx->mHotplug.lock);
 
-    //pthread_mutex_unlock(&mode_lock);  
-    
-    return  var_src.yoffset/var_src.yres;
-      
+    return  ret;
 }
       
 /*
@@ -2477,6 +3720,9 @@ static int display_changemode(struct display_device_t *dev,int displayno,int val
             return  -1;
          }
 
+         // while the master still scans out, so the thread's vsync comes
+         display_mirror_stop(ctx);
+
          if(g_displaymode == DISPLAY_MODE_SINGLE)
          {
             status = display_singlechangemode(dev,displayno,value0,value1);
@@ -2498,6 +3744,8 @@ static int display_changemode(struct display_device_t *dev,int displayno,int val
             status = -1;
          }
 
+         display_mirror_update(ctx);
+
          pthread_mutex_unlock(&mode_lock);
     } 
     else 
@@ -2913,6 +4161,20 @@ static int display_requestdualdiff(struct display_device_t *dev)
     return     0;
 }
       
+/*
+ * Format of the DUALSAME slave fb. With debug.display.slave16 set it is
+ * 565 whatever the master is: the mirror blit converts on the way, and
+ * the slave output fetches half the bytes per frame.
+ */
+static int display_slaveformat(int format)
+{
+    char                        value[PROPERTY_VALUE_MAX];
+
+    property_get("debug.display.slave16", value, "0");
+
+    return  atoi(value) ? HAL_PIXEL_FORMAT_RGB_565 : format;
+}
+
 /*
 **********************************************************************************************************************
 *                                               display_requestdualsame
@@ -2952,7 +4214,7 @@ static int display_requestdualsame(struct display_device_t *dev)
             {
                 g_display[i].fbmode    = FB_MODE_SCREEN1;
             }
-            para.format     			= g_display[i].format;
+            para.format     			= (i == g_masterdisplay) ? g_display[i].format : display_slaveformat(g_display[i].format);
             para.layer_mode 			= DISP_LAYER_WORK_MODE_NORMAL;
 
     		para.height     			= display_getheight(ctx,i,DISPLAY_DEFAULT);
@@ -2986,7 +4248,7 @@ static int display_requestdualsame(struct display_device_t *dev)
 
             g_display[i].fbmode     = FB_MODE_SCREEN0;
             para.fb_mode            = (__fb_mode_t)g_display[i].fbmode;
-            para.format             = g_display[i].format;
+            para.format             = (i == g_masterdisplay) ? g_display[i].format : display_slaveformat(g_display[i].format);
             para.output_height      = g_display[i].height;
             para.output_width       = g_display[i].width;
             para.valid_height      	= g_display[i].valid_height;
@@ -3133,7 +4395,7 @@ static int display_singleswitchtosame(struct display_device_t *dev,int mode,bool
 	        }
 	        
 	        para.fb_mode            = (__fb_mode_t)g_display[1 - g_masterdisplay].fbmode;
-	        para.format             = HAL_PIXEL_FORMAT_BGRA_8888;
+	        para.format             = display_slaveformat(HAL_PIXEL_FORMAT_BGRA_8888);
 	        para.output_height      = g_display[1 - g_masterdisplay].height;
 	        para.output_width       = g_display[1 - g_masterdisplay].width;
 	        para.valid_height      	= g_display[1 - g_masterdisplay].valid_height;
@@ -3174,7 +4436,7 @@ static int display_singleswitchtosame(struct display_device_t *dev,int mode,bool
 	        }
 	        
 	        para.fb_mode            = (__fb_mode_t)g_display[1 - g_masterdisplay].fbmode;
-	        para.format             = HAL_PIXEL_FORMAT_BGRA_8888;
+	        para.format             = display_slaveformat(HAL_PIXEL_FORMAT_BGRA_8888);
 	        para.output_height      = g_display[1 - g_masterdisplay].height;
 	        para.output_width       = g_display[1 - g_masterdisplay].width;
 	        para.valid_height      	= g_display[1 - g_masterdisplay].valid_height;
@@ -3372,6 +4634,8 @@ static int display_setmode(struct display_device_t *dev,int mode,struct display_
     	
     	//LOGD("g_displaymode1 = %d,mode = %d\n",g_displaymode,mode);
     	
+        display_mirror_stop(ctx);
+
     	if((g_displaymode == DISPLAY_MODE_SINGLE) && (mode == DISPLAY_MODE_DUALSAME))
     	{
             g_displaymode = mode;
@@ -3396,6 +4660,8 @@ static int display_setmode(struct display_device_t *dev,int mode,struct display_
 	        
 	        //LOGD("display_requestmode!\n");
     	}
+
+        display_mirror_update(ctx);
         
         pthread_mutex_unlock(&mode_lock);
 
@@ -3724,9 +4990,12 @@ static int display_dualsamesetmaster(struct display_device_t *dev,int master)
 
 static int display_setmasterdisplay(struct display_device_t *dev,int master)
 {
+    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
     int     ret;
 
     pthread_mutex_lock(&mode_lock);
+    display_mirror_stop(ctx);
+
     if(g_displaymode == DISPLAY_MODE_SINGLE)
     {  
         ret = display_singlesetmaster(dev,master);
@@ -3744,6 +5013,8 @@ static int display_setmasterdisplay(struct display_device_t *dev,int master)
         ret = display_duallcdsetmaster(dev,master);
     }
 
+    display_mirror_update(ctx);
+
     pthread_mutex_unlock(&mode_lock);
 
     return  ret;
@@ -3890,6 +5161,122 @@ static int display_getdisplaycount(struct display_device_t *dev)
 	return MAX_DISPLAY_NUM;
 }
       
+/*
+**********************************************************************************************************************
+*                                               display_benchg2d
+*
+* Description:      time a g2d stretch of 800x480 to width x height, for display_scale_benchmark. the source is
+*                   the start of fb0, only read. the destination is fb1, and only while no display shows it:
+*                   it is the one physical memory the hal hands out itself, and gets redrawn when it is
+*                   switched on 
+*
+* parameters:       format is a DISPLAY_SCALE_* format, used for both 
+*
+* return:           ns per frame, -1 when there is no g2d or no room
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int64_t display_benchg2d(void* arg,int width,int height,int format)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)arg;
+    const int                   iterations = 10;
+    struct display_fbinfo_t*    src;
+    struct display_fbinfo_t*    dst;
+    struct display_g2dbatch_t   batch;
+    g2d_data_fmt                g2dformat;
+    g2d_rect                    src_rect;
+    g2d_rect                    dst_rect;
+    uint32_t                    bpp;
+    int                         src_image;
+    int                         dst_image;
+    int64_t                     t;
+    int                         i;
+
+    if(ctx->mSoftOnly || display_openg2d(ctx) < 0)
+    {
+        return  -1;
+    }
+    for(i = 0;i < MAX_DISPLAY_NUM;i++)
+    {
+        if(g_display[i].isopen && g_display[i].fb_id == 1)
+        {
+            return  -1;
+        }
+    }
+
+    switch(format)
+    {
+        case DISPLAY_SCALE_RGB565:
+            g2dformat   = G2D_FMT_RGB565;
+            bpp         = 2;
+            break;
+
+        case DISPLAY_SCALE_BGRA8888:
+            g2dformat   = G2D_FMT_ARGB_AYUV8888;
+            bpp         = 4;
+            break;
+
+        default:
+            return  -1;
+    }
+
+    pthread_mutex_lock(&ctx->mCacheLock);
+    src = display_getfbinfo(ctx,0);
+    dst = display_getfbinfo(ctx,1);
+    if(!src || !dst || src->fix.smem_len < 800 * 480 * bpp
+       || dst->fix.smem_len < uint32_t(width) * height * bpp)
+    {
+        pthread_mutex_unlock(&ctx->mCacheLock);
+
+        return  -1;
+    }
+
+    display_g2d_begin(&batch,ctx->mFD_mp,NULL);
+    src_image = display_g2d_image(&batch,src->fix.smem_start,800,480,g2dformat);
+    dst_image = display_g2d_image(&batch,dst->fix.smem_start,width,height,g2dformat);
+    pthread_mutex_unlock(&ctx->mCacheLock);
+
+    src_rect.x = 0;
+    src_rect.y = 0;
+    src_rect.w = 800;
+    src_rect.h = 480;
+    dst_rect.x = 0;
+    dst_rect.y = 0;
+    dst_rect.w = width;
+    dst_rect.h = height;
+
+    t = display_now_ns();
+    for(i = 0;i < iterations;i++)
+    {
+        display_g2d_blit(&batch,src_image,&src_rect,dst_image,&dst_rect);
+        if(display_g2d_submit(&batch) < 0)
+        {
+            return  -1;
+        }
+    }
+
+    return  (display_now_ns() - t) / iterations;
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_benchmark
+*
+* Description:      time the software scaler and the g2d at 800x480 -> 720p and 1080p 
+*
+* parameters:       
+*
+* return:           
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static void display_benchmark(struct display_context_t* ctx)
+{
+    display_scale_benchmark(display_getworkers(ctx),display_benchg2d,ctx);
+}
+
 /*
 **********************************************************************************************************************
 *                                               close_display
@@ -3915,23 +5302,33 @@ static int close_display(struct hw_device_t *dev)
     struct display_context_t* ctx = (struct display_context_t*)dev;
     if (ctx) 
     {
+        display_mirror_stop(ctx);
+        display_hotplug_stop(ctx);
+        pthread_mutex_destroy(&ctx->mMirror.damagelock);
+        pthread_mutex_destroy(&ctx->mHotplug.lock);
+        pthread_mutex_destroy(&ctx->mG2dStats.lock);
+
         if(ctx->mFD_disp)
         {
             close(ctx->mFD_disp);
         }
 
-        if(ctx->mFD_mp)
+        if(ctx->mFD_mp > 0)
         {
             close(ctx->mFD_mp);
         }
 
+        display_workers_destroy(ctx->mWorkers);
+
         for(i = 0;i < MAX_DISPLAY_NUM;i++)
         {
+            display_invalidatefb(ctx,i);
             if(ctx->mFD_fb[i])
             {
                 close(ctx->mFD_fb[i]);
             }
         }
+        pthread_mutex_destroy(&ctx->mCacheLock);
         
         free(ctx);
     }
@@ -3960,33 +5357,52 @@ static int open_display(const struct hw_module_t* module, const char* name,
         struct hw_device_t** device)
 {
     int status = 0;
+    char value[PROPERTY_VALUE_MAX];
+    pthread_mutexattr_t attr;
     display_context_t *ctx;
     ctx = (display_context_t *)malloc(sizeof(display_context_t));
     memset(ctx, 0, sizeof(*ctx));
 
-    ctx->device.common.tag          = HARDWARE_DEVICE_TAG;
-    ctx->device.common.version      = 1;
-    ctx->device.common.module       = const_cast<hw_module_t*>(module);
-    ctx->device.common.close        = close_display;
-    ctx->device.changemode          = display_changemode;
-    ctx->device.setdisplaymode      = display_setmode;
-    ctx->device.setdisplayparameter = display_setparameter;
-    ctx->device.gethdmistatus       = display_gethdmistatus;
-    ctx->device.gettvdacstatus      = display_gettvdacstatus;
-    ctx->device.opendisplay         = display_opendev;
-    ctx->device.closedisplay        = display_closedev;
-    ctx->device.getdisplayparameter = display_getparameter;
-    ctx->device.copysrcfbtodstfb    = display_copyfb;
-    ctx->device.pandisplay          = display_pandisplay;
-    ctx->device.request_modelock    = display_requestmodelock;
-    ctx->device.release_modelock    = display_releasemodelock;
-    ctx->device.setmasterdisplay    = display_setmasterdisplay;
-    ctx->device.getmasterdisplay    = display_getmasterdisplay;
-    ctx->device.getdisplaybufid     = display_getdisplaybufid;
-    ctx->device.getmaxwidthdisplay  = display_getmaxdisplayno;
-    ctx->device.getdisplaycount  	= display_getdisplaycount;
-    ctx->device.getdisplaymode		= display_getdisplaymode;
-    ctx->device.gethdmimaxmode		= display_gethdmimaxmode;
+    ctx->device.device.common.tag          = HARDWARE_DEVICE_TAG;
+    ctx->device.device.common.version      = DISPLAY_DEVICE_EXT_VERSION;
+    ctx->device.device.common.module       = const_cast<hw_module_t*>(module);
+    ctx->device.device.common.close        = close_display;
+    ctx->device.device.changemode          = display_changemode;
+    ctx->device.device.setdisplaymode      = display_setmode;
+    ctx->device.device.setdisplayparameter = display_setparameter;
+    ctx->device.device.gethdmistatus       = display_gethdmistatus;
+    ctx->device.device.gettvdacstatus      = display_gettvdacstatus;
+    ctx->device.device.opendisplay         = display_opendev;
+    ctx->device.device.closedisplay        = display_closedev;
+    ctx->device.device.getdisplayparameter = display_getparameter;
+    ctx->device.device.copysrcfbtodstfb    = display_devcopyfb;
+    ctx->device.device.pandisplay          = display_devpandisplay;
+    ctx->device.device.request_modelock    = display_requestmodelock;
+    ctx->device.device.release_modelock    = display_releasemodelock;
+    ctx->device.device.setmasterdisplay    = display_setmasterdisplay;
+    ctx->device.device.getmasterdisplay    = display_getmasterdisplay;
+    ctx->device.device.getdisplaybufid     = display_getdisplaybufid;
+    ctx->device.device.getmaxwidthdisplay  = display_getmaxdisplayno;
+    ctx->device.device.getdisplaycount  	= display_getdisplaycount;
+    ctx->device.device.getdisplaymode		= display_getdisplaymode;
+    ctx->device.device.gethdmimaxmode		= display_gethdmimaxmode;
+    ctx->device.copysrcfbrects      = display_devcopyfbrects;
+    ctx->device.setmirrordamage     = display_setmirrordamage;
+    ctx->device.gethdmimodelist     = display_gethdmimodelist;
+    ctx->device.sethotplugcallback  = display_sethotplugcallback;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ctx->mCacheLock,&attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_init(&ctx->mMirror.damagelock,NULL);
+    ctx->mMirror.ownedfb = -1;
+    pthread_mutex_init(&ctx->mHotplug.lock,NULL);
+    display_g2d_initstats(&ctx->mG2dStats);
+
+    property_get("debug.display.soft", value, "0");
+    ctx->mSoftOnly      = (atoi(value) != 0);
+    property_get("debug.display.softfilter", value, "bilinear");
+    ctx->mSoftFilter    = strcmp(value, "nearest") ? DISPLAY_SCALE_BILINEAR : DISPLAY_SCALE_NEAREST;
 
     //LOGD("start open_display!\n");
     ctx->mFD_disp = open("/dev/disp", O_RDWR, 0);
@@ -4001,11 +5417,17 @@ static int open_display(const struct hw_module_t* module, const char* name,
 
     if (status == 0) 
     {
-        *device = &ctx->device.common;
+        *device = &ctx->device.device.common;
+
+        property_get("debug.display.scale_bench", value, "0");
+        if(atoi(value))
+        {
+            display_benchmark(ctx);
+        }
     } 
     else 
     {
-        close_display(&ctx->device.common);
+        close_display(&ctx->device.device.common);
     }
 
     if(mutex_inited == false)
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2026 The sun4i display HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "display"
+
+#include <cutils/log.h>
+
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "display_g2d.h"
+
+/*****************************************************************************/
+
+static int64_t display_g2d_now_ns(void)
+{
+    struct timespec             t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return  int64_t(t.tv_sec) * 1000000000LL + t.tv_nsec;
+}
+
+void display_g2d_initstats(struct display_g2dstats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_init(&stats->lock, NULL);
+}
+
+void display_g2d_logstats(struct display_g2dstats_t* stats)
+{
+    static const char* const    names[DISPLAY_G2D_NUM_OPS] = { "blit", "blend", "fill" };
+    int                         i;
+
+    pthread_mutex_lock(&stats->lock);
+    LOGI("g2d: %u batches, %u ops (%u dropped, %u merged), %u ioctls, %u failed, "
+         "batch avg %.2f ms, max %.2f ms\n",
+         stats->numBatches, stats->numOps, stats->numDropped, stats->numMerged,
+         stats->numIoctls, stats->numFailed,
+         stats->numBatches ? stats->batchNs / (1e6 * stats->numBatches) : 0.0,
+         stats->maxBatchNs / 1e6);
+    for(i = 0;i < DISPLAY_G2D_NUM_OPS;i++)
+    {
+        if(stats->opCount[i])
+        {
+            LOGI("g2d:   %s: %u, avg %.3f ms, total %.2f ms\n", names[i],
+                 stats->opCount[i], stats->opNs[i] / (1e6 * stats->opCount[i]),
+                 stats->opNs[i] / 1e6);
+        }
+    }
+    pthread_mutex_unlock(&stats->lock);
+}
+
+void display_g2d_begin(struct display_g2dbatch_t* batch,int fd,
+                       struct display_g2dstats_t* stats)
+{
+    batch->fd           = fd;
+    batch->stats        = stats;
+    batch->err          = 0;
+    batch->numimages    = 0;
+    batch->numops       = 0;
+}
+
+int display_g2d_image(struct display_g2dbatch_t* batch,uint32_t addr,
+                      uint32_t width,uint32_t height,g2d_data_fmt format)
+{
+    g2d_image*                  image;
+    int                         i;
+
+    for(i = 0;i < batch->numimages;i++)
+    {
+        image = &batch->images[i];
+        if(image->addr[0] == addr && image->w == width && image->h == height
+           && image->format == format)
+        {
+            return  i;
+        }
+    }
+
+    if(batch->numimages == DISPLAY_G2D_MAX_IMAGES)
+    {
+        LOGE("g2d batch: too many images\n");
+
+        return  -1;
+    }
+
+    image = &batch->images[batch->numimages];
+    image->addr[0]      = addr;
+    image->addr[1]      = 0;
+    image->addr[2]      = 0;
+    image->w            = width;
+    image->h            = height;
+    image->format       = format;
+    image->pixel_seq    = G2D_SEQ_VYUY;     // what the fb blits always passed
+
+    return  batch->numimages++;
+}
+
+static bool display_g2d_contains(const g2d_rect* outer,const g2d_rect* inner)
+{
+    return  inner->x >= outer->x && inner->y >= outer->y
+            && inner->x + (int)inner->w <= outer->x + (int)outer->w
+            && inner->y + (int)inner->h <= outer->y + (int)outer->h;
+}
+
+/* fully replaces what is under dst_rect */
+static bool display_g2d_opaque(const struct display_g2dop_t* op)
+{
+    if(op->type == DISPLAY_G2D_BLIT)
+    {
+        return  op->flag == G2D_BLT_NONE;
+    }
+
+    return  op->type == DISPLAY_G2D_FILL && op->flag == G2D_FIL_NONE;
+}
+
+/*
+ * b continues a, left to right or top to bottom, in both images at the
+ * same scale: one blit of the union does the same.
+ */
+static bool display_g2d_join(struct display_g2dop_t* a,const struct display_g2dop_t* b)
+{
+    if(a->type != DISPLAY_G2D_BLIT || b->type != DISPLAY_G2D_BLIT
+       || a->flag != b->flag || a->src != b->src || a->dst != b->dst
+       || uint64_t(a->src_rect.w) * b->dst_rect.w != uint64_t(b->src_rect.w) * a->dst_rect.w
+       || uint64_t(a->src_rect.h) * b->dst_rect.h != uint64_t(b->src_rect.h) * a->dst_rect.h)
+    {
+        return  false;
+    }
+
+    if(a->src_rect.y == b->src_rect.y && a->src_rect.h == b->src_rect.h
+       && a->dst_rect.y == b->dst_rect.y && a->dst_rect.h == b->dst_rect.h
+       && a->src_rect.x + (int)a->src_rect.w == b->src_rect.x
+       && a->dst_rect.x + (int)a->dst_rect.w == b->dst_rect.x)
+    {
+        a->src_rect.w += b->src_rect.w;
+        a->dst_rect.w += b->dst_rect.w;
+
+        return  true;
+    }
+
+    if(a->src_rect.x == b->src_rect.x && a->src_rect.w == b->src_rect.w
+       && a->dst_rect.x == b->dst_rect.x && a->dst_rect.w == b->dst_rect.w
+       && a->src_rect.y + (int)a->src_rect.h == b->src_rect.y
+       && a->dst_rect.y + (int)a->dst_rect.h == b->dst_rect.y)
+    {
+        a->src_rect.h += b->src_rect.h;
+        a->dst_rect.h += b->dst_rect.h;
+
+        return  true;
+    }
+
+    return  false;
+}
+
+static int display_g2d_issue(struct display_g2dbatch_t* batch,const struct display_g2dop_t* op)
+{
+    g2d_blt                     blt;
+    g2d_stretchblt              stretch;
+    g2d_fillrect                fill;
+    int                         err;
+
+    if(op->type == DISPLAY_G2D_FILL)
+    {
+        fill.flag           = (g2d_fillrect_flags)op->flag;
+        fill.dst_image      = batch->images[op->dst];
+        fill.dst_rect       = op->dst_rect;
+        fill.color          = op->color;
+        fill.alpha          = op->alpha;
+
+        err = ioctl(batch->fd, G2D_CMD_FILLRECT, (unsigned long)&fill);
+    }
+    else if(op->src_rect.w == op->dst_rect.w && op->src_rect.h == op->dst_rect.h)
+    {
+        // no scaling, keep the scaler out of it
+        blt.flag            = (g2d_blt_flags)op->flag;
+        blt.src_image       = batch->images[op->src];
+        blt.src_rect        = op->src_rect;
+        blt.dst_image       = batch->images[op->dst];
+        blt.dst_x           = op->dst_rect.x;
+        blt.dst_y           = op->dst_rect.y;
+        blt.color           = op->color;
+        blt.alpha           = op->alpha;
+
+        err = ioctl(batch->fd, G2D_CMD_BITBLT, (unsigned long)&blt);
+    }
+    else
+    {
+        stretch.flag        = (g2d_blt_flags)op->flag;
+        stretch.src_image   = batch->images[op->src];
+        stretch.src_rect    = op->src_rect;
+        stretch.dst_image   = batch->images[op->dst];
+        stretch.dst_rect    = op->dst_rect;
+        stretch.color       = op->color;
+        stretch.alpha       = op->alpha;
+
+        err = ioctl(batch->fd, G2D_CMD_STRETCHBLT, (unsigned long)&stretch);
+    }
+
+    return  err;
+}
+
+int display_g2d_submit(struct display_g2dbatch_t* batch)
+{
+    struct display_g2dop_t*     ops = batch->ops;
+    bool                        drop[DISPLAY_G2D_MAX_OPS];
+    int64_t                     opns[DISPLAY_G2D_NUM_OPS];
+    uint32_t                    opcount[DISPLAY_G2D_NUM_OPS];
+    uint32_t                    numdropped = 0;
+    uint32_t                    nummerged = 0;
+    uint32_t                    numioctls = 0;
+    uint32_t                    numfailed = 0;
+    int64_t                     start;
+    int64_t                     t;
+    int                         last;
+    int                         i;
+    int                         j;
+    int                         err = batch->err;
+
+    if(batch->numops == 0)
+    {
+        batch->err = 0;
+
+        return  err;
+    }
+
+    start = display_g2d_now_ns();
+
+    // painted over before anyone gets to read it
+    for(i = 0;i < batch->numops;i++)
+    {
+        drop[i] = false;
+        if(!display_g2d_opaque(&ops[i]))
+        {
+            continue;
+        }
+        for(j = i + 1;j < batch->numops;j++)
+        {
+            if(ops[j].src == ops[i].dst)
+            {
+                break;
+            }
+            if(ops[j].dst == ops[i].dst && display_g2d_opaque(&ops[j])
+               && display_g2d_contains(&ops[j].dst_rect,&ops[i].dst_rect))
+            {
+                drop[i] = true;
+                numdropped++;
+                break;
+            }
+        }
+    }
+
+    // join neighbours in place, in order
+    last = -1;
+    for(i = 0;i < batch->numops;i++)
+    {
+        if(drop[i])
+        {
+            continue;
+        }
+        if(last >= 0 && display_g2d_join(&ops[last],&ops[i]))
+        {
+            drop[i] = true;
+            nummerged++;
+            continue;
+        }
+        last = i;
+    }
+
+    memset(opns, 0, sizeof(opns));
+    memset(opcount, 0, sizeof(opcount));
+    for(i = 0;i < batch->numops;i++)
+    {
+        if(drop[i])
+        {
+            continue;
+        }
+
+        t = display_g2d_now_ns();
+        if(display_g2d_issue(batch,&ops[i]) < 0)
+        {
+            LOGE("g2d op %d failed!\n", ops[i].type);
+            numfailed++;
+            err = -1;
+        }
+        opns[ops[i].type] += display_g2d_now_ns() - t;
+        opcount[ops[i].type]++;
+        numioctls++;
+    }
+
+    if(batch->stats)
+    {
+        struct display_g2dstats_t* stats = batch->stats;
+
+        t = display_g2d_now_ns() - start;
+        pthread_mutex_lock(&stats->lock);
+        stats->numBatches++;
+        stats->numOps      += batch->numops;
+        stats->numDropped  += numdropped;
+        stats->numMerged   += nummerged;
+        stats->numIoctls   += numioctls;
+        stats->numFailed   += numfailed;
+        for(i = 0;i < DISPLAY_G2D_NUM_OPS;i++)
+        {
+            stats->opNs[i]    += opns[i];
+            stats->opCount[i] += opcount[i];
+        }
+        stats->batchNs     += t;
+        if(t > stats->maxBatchNs)
+        {
+            stats->maxBatchNs = t;
+        }
+        pthread_mutex_unlock(&stats->lock);
+    }
+
+    batch->numops   = 0;
+    batch->err      = 0;
+
+    return  err;
+}
+
+static int display_g2d_record(struct display_g2dbatch_t* batch,int type,
+                              int src,const g2d_rect* src_rect,int dst,const g2d_rect* dst_rect,
+                              uint32_t flag,uint32_t color,uint32_t alpha)
+{
+    struct display_g2dop_t*     op;
+
+    if(dst < 0 || dst >= batch->numimages || (type != DISPLAY_G2D_FILL
+       && (src < 0 || src >= batch->numimages)))
+    {
+        batch->err = -1;
+
+        return  -1;
+    }
+
+    if(dst_rect->w == 0 || dst_rect->h == 0
+       || (type != DISPLAY_G2D_FILL && (src_rect->w == 0 || src_rect->h == 0)))
+    {
+        return  0;
+    }
+
+    if(batch->numops == DISPLAY_G2D_MAX_OPS)
+    {
+        // keep the error for the caller's own submit
+        if(display_g2d_submit(batch) < 0)
+        {
+            batch->err = -1;
+        }
+    }
+
+    op = &batch->ops[batch->numops++];
+    op->type        = type;
+    op->src         = (type == DISPLAY_G2D_FILL) ? -1 : src;
+    op->dst         = dst;
+    op->dst_rect    = *dst_rect;
+    op->flag        = flag;
+    op->color       = color;
+    op->alpha       = alpha;
+    if(src_rect)
+    {
+        op->src_rect = *src_rect;
+    }
+    else
+    {
+        memset(&op->src_rect, 0, sizeof(op->src_rect));
+    }
+
+    return  0;
+}
+
+int display_g2d_blit(struct display_g2dbatch_t* batch,int src,const g2d_rect* src_rect,
+                     int dst,const g2d_rect* dst_rect)
+{
+    return  display_g2d_record(batch,DISPLAY_G2D_BLIT,src,src_rect,dst,dst_rect,
+                               G2D_BLT_NONE,0,0);
+}
+
+int display_g2d_blend(struct display_g2dbatch_t* batch,int src,const g2d_rect* src_rect,
+                      int dst,const g2d_rect* dst_rect,uint32_t flag,uint32_t alpha)
+{
+    return  display_g2d_record(batch,DISPLAY_G2D_BLEND,src,src_rect,dst,dst_rect,
+                               flag,0,alpha);
+}
+
+int display_g2d_fill(struct display_g2dbatch_t* batch,int dst,const g2d_rect* dst_rect,
+                     uint32_t color,uint32_t flag,uint32_t alpha)
+{
+    return  display_g2d_record(batch,DISPLAY_G2D_FILL,-1,NULL,dst,dst_rect,
+                               flag,color,alpha);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2026 The sun4i display HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DISPLAY_G2D_H_
+#define DISPLAY_G2D_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <g2d_driver.h>
+
+/*****************************************************************************/
+
+#define DISPLAY_G2D_MAX_OPS     32
+#define DISPLAY_G2D_MAX_IMAGES  8
+
+enum
+{
+    DISPLAY_G2D_BLIT = 0,       // opaque copy, scaled when the rects differ
+    DISPLAY_G2D_BLEND,          // copy with pixel or plane alpha
+    DISPLAY_G2D_FILL,
+    DISPLAY_G2D_NUM_OPS
+};
+
+/*
+ * Where the blitter time goes, summed over every batch submitted with
+ * it. lock only guards the counters, batches from several threads may
+ * share one.
+ */
+struct display_g2dstats_t
+{
+    pthread_mutex_t             lock;
+    uint32_t                    numBatches;
+    uint32_t                    numOps;         // recorded
+    uint32_t                    numDropped;     // hidden by a later opaque op
+    uint32_t                    numMerged;      // folded into a neighbour
+    uint32_t                    numIoctls;
+    uint32_t                    numFailed;
+    uint32_t                    opCount[DISPLAY_G2D_NUM_OPS];
+    int64_t                     opNs[DISPLAY_G2D_NUM_OPS];
+    int64_t                     batchNs;
+    int64_t                     maxBatchNs;
+};
+
+struct display_g2dop_t
+{
+    int                         type;
+    int                         src;            // index in images, -1 for fills
+    int                         dst;
+    g2d_rect                    src_rect;
+    g2d_rect                    dst_rect;
+    uint32_t                    flag;           // g2d_blt_flags or g2d_fillrect_flags
+    uint32_t                    color;
+    uint32_t                    alpha;
+};
+
+/*
+ * A list of blitter operations, recorded and then submitted in one go.
+ * The images are described once per batch and shared by all the ops.
+ * On submit, ops entirely painted over by a later opaque op are dropped,
+ * abutting copies between the same images at the same scale are joined,
+ * and unscaled copies go through the cheaper BITBLT. The sun4i driver
+ * takes one op per ioctl, so what is left is one ioctl each.
+ *
+ * A batch lives on the caller's stack; it flushes itself when full.
+ */
+struct display_g2dbatch_t
+{
+    int                         fd;
+    struct display_g2dstats_t*  stats;
+    int                         err;            // some op failed since begin
+    int                         numimages;
+    g2d_image                   images[DISPLAY_G2D_MAX_IMAGES];
+    int                         numops;
+    struct display_g2dop_t      ops[DISPLAY_G2D_MAX_OPS];
+};
+
+void display_g2d_initstats(struct display_g2dstats_t* stats);
+void display_g2d_logstats(struct display_g2dstats_t* stats);
+
+void display_g2d_begin(struct display_g2dbatch_t* batch,int fd,
+                       struct display_g2dstats_t* stats);
+
+/* index of the image, for the ops below. -1 when the batch has too many */
+int  display_g2d_image(struct display_g2dbatch_t* batch,uint32_t addr,
+                       uint32_t width,uint32_t height,g2d_data_fmt format);
+
+int  display_g2d_blit(struct display_g2dbatch_t* batch,int src,const g2d_rect* src_rect,
+                      int dst,const g2d_rect* dst_rect);
+int  display_g2d_blend(struct display_g2dbatch_t* batch,int src,const g2d_rect* src_rect,
+                       int dst,const g2d_rect* dst_rect,uint32_t flag,uint32_t alpha);
+int  display_g2d_fill(struct display_g2dbatch_t* batch,int dst,const g2d_rect* dst_rect,
+                      uint32_t color,uint32_t flag,uint32_t alpha);
+
+/* submit what was recorded. returns -1 if any op since begin failed */
+int  display_g2d_submit(struct display_g2dbatch_t* batch);
+
+#endif /* DISPLAY_G2D_H_ */
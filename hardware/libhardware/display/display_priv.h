@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 The sun4i display HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DISPLAY_PRIV_H_
+#define DISPLAY_PRIV_H_
+
+#include <hardware/display.h>
+
+/*****************************************************************************/
+
+/*
+ * Entry points of the sun4i display HAL beyond display_device_t. From
+ * device.common.version 2 on, the device can be cast to
+ * display_device_ext_t; each entry says which version brought it.
+ */
+#define DISPLAY_DEVICE_EXT_VERSION  4
+
+struct display_rect_t
+{
+    int                         x;
+    int                         y;
+    int                         width;
+    int                         height;
+};
+
+struct display_modeinfo_t
+{
+    int                         format;         // DISPLAY_TVFORMAT_*
+    int                         width;
+    int                         height;
+    int                         refresh;        // in Hz, fields per second when interlaced
+    int                         interlaced;
+};
+
+/*
+ * displayno is the display of that type, -1 when none is configured as
+ * one; type is DISPLAY_DEVICE_HDMI or DISPLAY_DEVICE_TV. Called from the
+ * HAL's hotplug thread, without any HAL lock held.
+ */
+typedef void (*display_hotplug_callback_t)(void *cookie,int displayno,int type,int connected);
+
+struct display_device_ext_t
+{
+    struct display_device_t     device;
+
+    /*
+     * Version 2. Same as copysrcfbtodstfb, but only for the given
+     * rectangles of the source fb, scaled into the destination. count < 0
+     * copies it all.
+     */
+    int (*copysrcfbrects)(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                          int dstfb_id,int dstfb_bufno,
+                          const struct display_rect_t *rects,int count);
+
+    /*
+     * What changed on the master since the last frame, in master fb
+     * coordinates. Call it once per frame, before posting the frame it
+     * describes; the DUALSAME mirror then only copies that much to the
+     * slave, and counts the calls to tell which frames it dropped.
+     * Frames posted without it are copied whole.
+     */
+    int (*setmirrordamage)(struct display_device_t *dev,
+                           const struct display_rect_t *rects,int count);
+
+    /*
+     * Version 3. The HDMI modes the sink supports, up to max of them into
+     * modes; returns how many there are. The driver is only asked once
+     * per hotplug, this and gethdmimaxmode are answered from that.
+     */
+    int (*gethdmimodelist)(struct display_device_t *dev,
+                           struct display_modeinfo_t *modes,int max);
+
+    /*
+     * Version 4. Be told of HDMI and TV cable changes as the kernel
+     * reports them, instead of polling gethdmistatus. NULL unregisters.
+     */
+    int (*sethotplugcallback)(struct display_device_t *dev,
+                              display_hotplug_callback_t callback,void *cookie);
+};
+
+#endif /* DISPLAY_PRIV_H_ */
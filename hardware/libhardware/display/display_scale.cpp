@@ -0,0 +1,787 @@
+/*
+ * Copyright (C) 2026 The sun4i display HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "display"
+
+#include <cutils/log.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "display_scale.h"
+
+/*****************************************************************************/
+
+// never split into more stripes than this
+#define MAX_WORKERS     4
+
+struct display_worker_t
+{
+    struct display_workers_t*   pool;
+    int                         index;
+    pthread_t                   thread;
+};
+
+struct display_workers_t
+{
+    int                         numThreads;     // including the calling thread
+    struct display_worker_t     workers[MAX_WORKERS];
+    pthread_mutex_t             runlock;        // one job at a time, the pool is shared between threads
+    pthread_mutex_t             lock;
+    pthread_cond_t              start;
+    pthread_cond_t              done;
+    uint32_t                    generation;
+    int                         pending;
+    bool                        exiting;
+
+    // the job being run
+    display_stripe_func_t       func;
+    void*                       arg;
+    int                         rows;
+};
+
+static void display_stripeof(int rows,int n,int i,int *first,int *count)
+{
+    *first = (int)(((int64_t)rows * i) / n);
+    *count = (int)(((int64_t)rows * (i + 1)) / n) - *first;
+}
+
+static void* display_worker_main(void* data)
+{
+    struct display_worker_t*    w = (struct display_worker_t*)data;
+    struct display_workers_t*   pool = w->pool;
+    display_stripe_func_t       func;
+    void*                       arg;
+    uint32_t                    seen = 0;
+    int                         first;
+    int                         count;
+
+    pthread_mutex_lock(&pool->lock);
+    for(;;)
+    {
+        while(!pool->exiting && pool->generation == seen)
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if(pool->exiting)
+        {
+            break;
+        }
+        seen    = pool->generation;
+        func    = pool->func;
+        arg     = pool->arg;
+        display_stripeof(pool->rows, pool->numThreads, w->index, &first, &count);
+        pthread_mutex_unlock(&pool->lock);
+
+        if(count > 0)
+        {
+            func(arg, first, count);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->pending == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return  NULL;
+}
+
+struct display_workers_t* display_workers_create(int numThreads)
+{
+    struct display_workers_t*   pool;
+    struct display_worker_t*    w;
+    int                         i;
+
+    if(numThreads <= 0)
+    {
+        numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(numThreads <= 0)
+    {
+        numThreads = 1;
+    }
+    if(numThreads > MAX_WORKERS)
+    {
+        numThreads = MAX_WORKERS;
+    }
+
+    pool = (struct display_workers_t*)malloc(sizeof(*pool));
+    if(!pool)
+    {
+        return  NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->runlock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->numThreads = 1;
+
+    // worker 0 is the caller
+    for(i = 1;i < numThreads;i++)
+    {
+        w = &pool->workers[i];
+        w->pool     = pool;
+        w->index    = i;
+        if(pthread_create(&w->thread, NULL, display_worker_main, w) != 0)
+        {
+            LOGW("couldn't start scale worker %d, using %d thread(s)\n", i, pool->numThreads);
+            break;
+        }
+        pool->numThreads++;
+    }
+
+    return  pool;
+}
+
+void display_workers_destroy(struct display_workers_t* pool)
+{
+    int                         i;
+
+    if(!pool)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->exiting = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for(i = 1;i < pool->numThreads;i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->runlock);
+    free(pool);
+}
+
+int display_workers_count(struct display_workers_t const* pool)
+{
+    return  pool ? pool->numThreads : 1;
+}
+
+void display_workers_run(struct display_workers_t* pool,int rows,
+                         display_stripe_func_t func,void* arg)
+{
+    int                         first;
+    int                         count;
+
+    if(rows <= 0)
+    {
+        return;
+    }
+    if(!pool || pool->numThreads == 1 || rows < pool->numThreads)
+    {
+        func(arg, 0, rows);
+
+        return;
+    }
+
+    // a second caller would overwrite the job while the workers still run it
+    pthread_mutex_lock(&pool->runlock);
+    pthread_mutex_lock(&pool->lock);
+    pool->func      = func;
+    pool->arg       = arg;
+    pool->rows      = rows;
+    pool->pending   = pool->numThreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    display_stripeof(rows, pool->numThreads, 0, &first, &count);
+    func(arg, first, count);
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->pending)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->runlock);
+}
+
+/*****************************************************************************/
+
+/*
+ * Row kernels. Everything in between is 32-bit pixels in the byte order
+ * of the source: a 565 source expands to BGRA, or RGBA when red is at
+ * the bottom. The NEON and C versions give the same result.
+ */
+
+static void display_expand565(uint32_t* d,const uint16_t* s,int n)
+{
+    uint8_t*                    p = (uint8_t*)d;
+
+#if defined(__ARM_NEON__)
+    while(n >= 8)
+    {
+        uint16x8_t  v = vld1q_u16(s);
+        uint8x8x4_t o;
+        uint8x8_t   r = vshrn_n_u16(v, 8);
+        uint8x8_t   g = vshrn_n_u16(v, 3);
+        uint8x8_t   b = vmovn_u16(vshlq_n_u16(v, 3));
+
+        r = vand_u8(r, vdup_n_u8(0xf8));
+        g = vand_u8(g, vdup_n_u8(0xfc));
+        o.val[0] = vorr_u8(b, vshr_n_u8(b, 5));
+        o.val[1] = vorr_u8(g, vshr_n_u8(g, 6));
+        o.val[2] = vorr_u8(r, vshr_n_u8(r, 5));
+        o.val[3] = vdup_n_u8(0xff);
+        vst4_u8(p, o);
+        p += 32;
+        s += 8;
+        n -= 8;
+    }
+#endif
+    while(n-- > 0)
+    {
+        uint16_t    v = *s++;
+        uint8_t     r = (v >> 8) & 0xf8;
+        uint8_t     g = (v >> 3) & 0xfc;
+        uint8_t     b = (v << 3) & 0xf8;
+
+        p[0] = b | (b >> 5);
+        p[1] = g | (g >> 6);
+        p[2] = r | (r >> 5);
+        p[3] = 0xff;
+        p += 4;
+    }
+}
+
+/* top2: byte 2 of each pixel goes to the top 5 bits, byte 0 to the bottom */
+static void display_pack565(uint16_t* d,const uint32_t* s,int n,bool top2)
+{
+    const uint8_t*              p = (const uint8_t*)s;
+    const int                   ri = top2 ? 2 : 0;
+    const int                   bi = top2 ? 0 : 2;
+
+#if defined(__ARM_NEON__)
+    while(n >= 8)
+    {
+        uint8x8x4_t in = vld4_u8(p);
+        uint16x8_t  v = vshll_n_u8(top2 ? in.val[2] : in.val[0], 8);
+
+        v = vsriq_n_u16(v, vshll_n_u8(in.val[1], 8), 5);
+        v = vsriq_n_u16(v, vshll_n_u8(top2 ? in.val[0] : in.val[2], 8), 11);
+        vst1q_u16(d, v);
+        p += 32;
+        d += 8;
+        n -= 8;
+    }
+#endif
+    while(n-- > 0)
+    {
+        *d++ = ((p[ri] >> 3) << 11) | ((p[1] >> 2) << 5) | (p[bi] >> 3);
+        p += 4;
+    }
+}
+
+static void display_swaprb(uint32_t* d,const uint32_t* s,int n)
+{
+#if defined(__ARM_NEON__)
+    while(n >= 8)
+    {
+        uint8x8x4_t v = vld4_u8((const uint8_t*)s);
+        uint8x8_t   t = v.val[0];
+
+        v.val[0] = v.val[2];
+        v.val[2] = t;
+        vst4_u8((uint8_t*)d, v);
+        s += 8;
+        d += 8;
+        n -= 8;
+    }
+#endif
+    while(n-- > 0)
+    {
+        uint32_t    v = *s++;
+
+        *d++ = (v & 0xff00ff00) | ((v >> 16) & 0xff) | ((v & 0xff) << 16);
+    }
+}
+
+/* a and b weighted 128 - f and f, f in 0..127 */
+static void display_blendrows(uint32_t* d,const uint32_t* a,const uint32_t* b,int n,int f)
+{
+    const uint8_t*              pa = (const uint8_t*)a;
+    const uint8_t*              pb = (const uint8_t*)b;
+    uint8_t*                    pd = (uint8_t*)d;
+    int                         bytes = n * 4;
+
+#if defined(__ARM_NEON__)
+    const uint8x8_t             wa = vdup_n_u8(128 - f);
+    const uint8x8_t             wb = vdup_n_u8(f);
+
+    while(bytes >= 16)
+    {
+        uint8x16_t  va = vld1q_u8(pa);
+        uint8x16_t  vb = vld1q_u8(pb);
+        uint16x8_t  lo = vmull_u8(vget_low_u8(va), wa);
+        uint16x8_t  hi = vmull_u8(vget_high_u8(va), wa);
+
+        lo = vmlal_u8(lo, vget_low_u8(vb), wb);
+        hi = vmlal_u8(hi, vget_high_u8(vb), wb);
+        vst1q_u8(pd, vcombine_u8(vshrn_n_u16(lo, 7), vshrn_n_u16(hi, 7)));
+        pa += 16;
+        pb += 16;
+        pd += 16;
+        bytes -= 16;
+    }
+#endif
+    while(bytes-- > 0)
+    {
+        *pd++ = (*pa++ * (128 - f) + *pb++ * f) >> 7;
+    }
+}
+
+/*
+ * Horizontal pass, a gather through the column tables. Two channels at
+ * a time in a 32-bit word, the weights are out of 256.
+ */
+static void display_hscale(uint32_t* d,const uint32_t* s,const int* x0,const int* x1,
+                           const uint8_t* fx,int n)
+{
+    int                         i;
+
+    if(!fx)
+    {
+        for(i = 0;i < n;i++)
+        {
+            d[i] = s[x0[i]];
+        }
+
+        return;
+    }
+
+    i = 0;
+#if defined(__ARM_NEON__)
+    /*
+     * Two pixels per d register, gathered a lane at a time. vtbl spreads
+     * each weight over the four bytes of its pixel, and a * (256 - f) is
+     * done as a * (255 - f) + a to stay within the u8 multiplies.
+     */
+    static const uint8_t        spread[4][8] =
+    {
+        { 0, 0, 0, 0, 1, 1, 1, 1 },
+        { 2, 2, 2, 2, 3, 3, 3, 3 },
+        { 4, 4, 4, 4, 5, 5, 5, 5 },
+        { 6, 6, 6, 6, 7, 7, 7, 7 }
+    };
+    const uint8x8_t             k255 = vdup_n_u8(255);
+
+    for(;i + 8 <= n;i += 8)
+    {
+        uint8x8_t   f8 = vld1_u8(fx + i);
+        uint8x8_t   o[4];
+        int         j;
+
+        for(j = 0;j < 4;j++)
+        {
+            uint32x2_t  a = vdup_n_u32(0);
+            uint32x2_t  b = vdup_n_u32(0);
+            uint8x8_t   f = vtbl1_u8(f8, vld1_u8(spread[j]));
+            uint16x8_t  sum;
+
+            a = vld1_lane_u32(s + x0[i + 2 * j], a, 0);
+            a = vld1_lane_u32(s + x0[i + 2 * j + 1], a, 1);
+            b = vld1_lane_u32(s + x1[i + 2 * j], b, 0);
+            b = vld1_lane_u32(s + x1[i + 2 * j + 1], b, 1);
+            sum = vmull_u8(vreinterpret_u8_u32(a), vsub_u8(k255, f));
+            sum = vaddw_u8(sum, vreinterpret_u8_u32(a));
+            sum = vmlal_u8(sum, vreinterpret_u8_u32(b), f);
+            o[j] = vshrn_n_u16(sum, 8);
+        }
+        vst1q_u8((uint8_t*)(d + i), vcombine_u8(o[0], o[1]));
+        vst1q_u8((uint8_t*)(d + i + 4), vcombine_u8(o[2], o[3]));
+    }
+#endif
+    for(;i < n;i++)
+    {
+        uint32_t    a = s[x0[i]];
+        uint32_t    b = s[x1[i]];
+        uint32_t    f = fx[i];
+        uint32_t    rb;
+        uint32_t    ag;
+
+        if(f == 0)
+        {
+            d[i] = a;
+            continue;
+        }
+        rb = (((a & 0x00ff00ff) * (256 - f) + (b & 0x00ff00ff) * f) >> 8) & 0x00ff00ff;
+        ag = (((a >> 8) & 0x00ff00ff) * (256 - f) + ((b >> 8) & 0x00ff00ff) * f) & 0xff00ff00;
+        d[i] = rb | ag;
+    }
+}
+
+/*****************************************************************************/
+
+struct display_scalejob_t
+{
+    const struct display_surface_t* dst;
+    const struct display_surface_t* src;
+    int                         x;              // dst_rect
+    int                         y;
+    int                         width;
+    int                         filter;
+    const int*                  x0;             // per dst column of the rect
+    const int*                  x1;
+    const uint8_t*              fx;             // NULL for nearest
+    int                         failed;
+};
+
+static bool display_is565(int format)
+{
+    return  format == DISPLAY_SCALE_RGB565 || format == DISPLAY_SCALE_BGR565;
+}
+
+static int display_bpp(int format)
+{
+    return  display_is565(format) ? 2 : 4;
+}
+
+/* red in byte 2 of the 32-bit pixels this format expands to */
+static bool display_red16(int format)
+{
+    return  format == DISPLAY_SCALE_RGB565 || format == DISPLAY_SCALE_BGRA8888;
+}
+
+/* source row y as 32-bit pixels, expanded into tmp if it has to be */
+static const uint32_t* display_srcrow(const struct display_surface_t* src,int y,uint32_t* tmp)
+{
+    const uint8_t*              row = (const uint8_t*)src->base + y * src->stride;
+
+    if(display_is565(src->format))
+    {
+        display_expand565(tmp, (const uint16_t*)row, src->width);
+
+        return  tmp;
+    }
+
+    return  (const uint32_t*)row;
+}
+
+static void display_scale_stripe(void* arg,int first,int count)
+{
+    struct display_scalejob_t*  job = (struct display_scalejob_t*)arg;
+    const struct display_surface_t* dst = job->dst;
+    const struct display_surface_t* src = job->src;
+    const bool                  same = display_red16(dst->format) == display_red16(src->format);
+    const bool                  swap = !display_is565(dst->format) && !same;
+    const bool                  direct = !display_is565(dst->format) && same;
+    uint32_t*                   buf;
+    uint32_t*                   row0;
+    uint32_t*                   row1;
+    uint32_t*                   vrow;
+    uint32_t*                   hrow;
+    const uint32_t*             a;
+    const uint32_t*             b;
+    uint8_t*                    out;
+    int64_t                     p;
+    int                         y;
+    int                         sy;
+    int                         f;
+
+    buf = (uint32_t*)malloc((3 * src->width + job->width) * sizeof(uint32_t));
+    if(!buf)
+    {
+        job->failed = 1;
+
+        return;
+    }
+    row0    = buf;
+    row1    = row0 + src->width;
+    vrow    = row1 + src->width;
+    hrow    = vrow + src->width;
+
+    for(y = job->y + first;y < job->y + first + count;y++)
+    {
+        // sample the middle of the destination pixel
+        p = (int64_t)(2 * y + 1) * src->height * 256 / (2 * dst->height);
+        if(job->filter == DISPLAY_SCALE_BILINEAR)
+        {
+            p = (p < 128) ? 0 : p - 128;
+            sy  = (int)(p >> 8);
+            f   = (int)(p & 0xff) >> 1;
+            if(sy >= src->height - 1)
+            {
+                sy  = src->height - 1;
+                f   = 0;
+            }
+        }
+        else
+        {
+            sy  = (int)(p >> 8);
+            f   = 0;
+        }
+
+        a = display_srcrow(src, sy, row0);
+        if(f)
+        {
+            b = display_srcrow(src, sy + 1, row1);
+            display_blendrows(vrow, a, b, src->width, f);
+            a = vrow;
+        }
+
+        out = (uint8_t*)dst->base + y * dst->stride + job->x * display_bpp(dst->format);
+        if(direct)
+        {
+            display_hscale((uint32_t*)out, a, job->x0, job->x1, job->fx, job->width);
+            continue;
+        }
+
+        display_hscale(hrow, a, job->x0, job->x1, job->fx, job->width);
+        if(swap)
+        {
+            display_swaprb((uint32_t*)out, hrow, job->width);
+        }
+        else
+        {
+            display_pack565((uint16_t*)out, hrow, job->width, same);
+        }
+    }
+
+    free(buf);
+}
+
+struct display_copyjob_t
+{
+    const struct display_surface_t* dst;
+    const struct display_surface_t* src;
+    const struct display_rect_t*    rect;
+};
+
+static void display_copy_stripe(void* arg,int first,int count)
+{
+    struct display_copyjob_t*   job = (struct display_copyjob_t*)arg;
+    const int                   bpp = display_bpp(job->src->format);
+    int                         y;
+
+    for(y = job->rect->y + first;y < job->rect->y + first + count;y++)
+    {
+        memcpy((uint8_t*)job->dst->base + y * job->dst->stride + job->rect->x * bpp,
+               (const uint8_t*)job->src->base + y * job->src->stride + job->rect->x * bpp,
+               job->rect->width * bpp);
+    }
+}
+
+int display_scale(struct display_workers_t* workers,
+                  const struct display_surface_t* dst,const struct display_surface_t* src,
+                  const struct display_rect_t* dst_rect,int filter)
+{
+    struct display_scalejob_t   job;
+    struct display_copyjob_t    copy;
+    struct display_rect_t       rect;
+    int*                        x0;
+    int*                        x1;
+    uint8_t*                    fx;
+    int64_t                     p;
+    int                         i;
+
+    if(src->width <= 0 || src->height <= 0 || dst->width <= 0 || dst->height <= 0
+       || src->format > DISPLAY_SCALE_RGBA8888 || dst->format > DISPLAY_SCALE_RGBA8888)
+    {
+        return  -1;
+    }
+
+    rect.x      = 0;
+    rect.y      = 0;
+    rect.width  = dst->width;
+    rect.height = dst->height;
+    if(dst_rect)
+    {
+        rect = *dst_rect;
+        if(rect.x < 0)
+        {
+            rect.width += rect.x;
+            rect.x = 0;
+        }
+        if(rect.y < 0)
+        {
+            rect.height += rect.y;
+            rect.y = 0;
+        }
+        if(rect.x + rect.width > dst->width)
+        {
+            rect.width = dst->width - rect.x;
+        }
+        if(rect.y + rect.height > dst->height)
+        {
+            rect.height = dst->height - rect.y;
+        }
+    }
+    if(rect.width <= 0 || rect.height <= 0)
+    {
+        return  0;
+    }
+
+    if(src->width == dst->width && src->height == dst->height && src->format == dst->format)
+    {
+        copy.dst    = dst;
+        copy.src    = src;
+        copy.rect   = &rect;
+        display_workers_run(workers, rect.height, display_copy_stripe, &copy);
+
+        return  0;
+    }
+
+    x0 = (int*)malloc(rect.width * (2 * sizeof(int) + 1));
+    if(!x0)
+    {
+        return  -1;
+    }
+    x1 = x0 + rect.width;
+    fx = (uint8_t*)(x1 + rect.width);
+
+    for(i = 0;i < rect.width;i++)
+    {
+        p = (int64_t)(2 * (rect.x + i) + 1) * src->width * 256 / (2 * dst->width);
+        if(filter == DISPLAY_SCALE_BILINEAR)
+        {
+            p = (p < 128) ? 0 : p - 128;
+        }
+        x0[i] = (int)(p >> 8);
+        fx[i] = (uint8_t)(p & 0xff);
+        if(x0[i] >= src->width - 1)
+        {
+            x0[i] = src->width - 1;
+            fx[i] = 0;
+        }
+        x1[i] = (x0[i] + 1 < src->width) ? x0[i] + 1 : x0[i];
+    }
+
+    job.dst     = dst;
+    job.src     = src;
+    job.x       = rect.x;
+    job.y       = rect.y;
+    job.width   = rect.width;
+    job.filter  = filter;
+    job.x0      = x0;
+    job.x1      = x1;
+    job.fx      = (filter == DISPLAY_SCALE_BILINEAR) ? fx : NULL;
+    job.failed  = 0;
+    display_workers_run(workers, rect.height, display_scale_stripe, &job);
+
+    free(x0);
+
+    return  job.failed ? -1 : 0;
+}
+
+/*****************************************************************************/
+
+static int64_t display_scale_now_ns(void)
+{
+    struct timespec             t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return  int64_t(t.tv_sec) * 1000000000LL + t.tv_nsec;
+}
+
+void display_scale_benchmark(struct display_workers_t* workers,
+                             display_scale_benchfunc_t hwfunc,void* hwarg)
+{
+    static const int            sizes[2][2] = { { 1280, 720 }, { 1920, 1080 } };
+    static const int            formats[2] = { DISPLAY_SCALE_RGB565, DISPLAY_SCALE_BGRA8888 };
+    const int                   iterations = 10;
+    struct display_surface_t    src;
+    struct display_surface_t    dst;
+    uint8_t*                    sbuf;
+    uint8_t*                    dbuf;
+    int64_t                     t0;
+    int64_t                     t1;
+    int64_t                     t2;
+    int64_t                     hw;
+    char                        hwtime[32];
+    int                         s;
+    int                         f;
+    int                         i;
+
+    sbuf = (uint8_t*)malloc(800 * 480 * 4);
+    dbuf = (uint8_t*)malloc(1920 * 1080 * 4);
+    if(!sbuf || !dbuf)
+    {
+        free(sbuf);
+        free(dbuf);
+
+        return;
+    }
+    for(i = 0;i < 800 * 480 * 4;i++)
+    {
+        sbuf[i] = (uint8_t)(i * 7);
+    }
+
+    for(f = 0;f < 2;f++)
+    {
+        src.base    = sbuf;
+        src.width   = 800;
+        src.height  = 480;
+        src.format  = formats[f];
+        src.stride  = src.width * display_bpp(src.format);
+        for(s = 0;s < 2;s++)
+        {
+            dst.base    = dbuf;
+            dst.width   = sizes[s][0];
+            dst.height  = sizes[s][1];
+            dst.format  = formats[f];
+            dst.stride  = dst.width * display_bpp(dst.format);
+
+            t0 = display_scale_now_ns();
+            for(i = 0;i < iterations;i++)
+            {
+                display_scale(workers, &dst, &src, NULL, DISPLAY_SCALE_NEAREST);
+            }
+            t1 = display_scale_now_ns();
+            for(i = 0;i < iterations;i++)
+            {
+                display_scale(workers, &dst, &src, NULL, DISPLAY_SCALE_BILINEAR);
+            }
+            t2 = display_scale_now_ns();
+
+            hw = hwfunc ? hwfunc(hwarg, dst.width, dst.height, dst.format) : -1;
+            if(hw < 0)
+            {
+                strcpy(hwtime, "not timed");
+            }
+            else
+            {
+                snprintf(hwtime, sizeof(hwtime), "%.2f ms", hw / 1e6);
+            }
+
+            LOGI("scale benchmark: 800x480 -> %dx%d, %d bpp, x%d: nearest %.2f ms, bilinear %.2f ms, g2d %s\n",
+                 dst.width, dst.height, display_bpp(dst.format) * 8,
+                 display_workers_count(workers),
+                 (t1 - t0) / (1e6 * iterations), (t2 - t1) / (1e6 * iterations), hwtime);
+        }
+    }
+
+    free(sbuf);
+    free(dbuf);
+}
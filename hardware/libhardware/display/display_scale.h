@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 The sun4i display HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DISPLAY_SCALE_H_
+#define DISPLAY_SCALE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "display_priv.h"
+
+/*****************************************************************************/
+
+/*
+ * Software fallback of the G2D stretch blit, for when the blitter can't
+ * be opened or fails. Works on the mmapped framebuffers, with NEON where
+ * the build has it, in horizontal stripes over a pool of threads.
+ */
+
+enum
+{
+    DISPLAY_SCALE_RGB565 = 0,       // red at bit 11
+    DISPLAY_SCALE_BGR565,           // red at bit 0
+    DISPLAY_SCALE_BGRA8888,         // red at bit 16, blue first in memory
+    DISPLAY_SCALE_RGBA8888          // red at bit 0
+};
+
+enum
+{
+    DISPLAY_SCALE_NEAREST = 0,
+    DISPLAY_SCALE_BILINEAR
+};
+
+struct display_surface_t
+{
+    void*                       base;
+    size_t                      stride;         // in bytes
+    int                         width;
+    int                         height;
+    int                         format;
+};
+
+/*
+ * Threads that a per-row job is split across. The caller takes the first
+ * stripe itself, with a single thread everything runs inline. Any thread
+ * may run a job, concurrent runs wait for each other.
+ */
+struct display_workers_t;
+
+typedef void (*display_stripe_func_t)(void* arg,int first,int count);
+
+struct display_workers_t* display_workers_create(int numThreads);
+void display_workers_destroy(struct display_workers_t* workers);
+int  display_workers_count(struct display_workers_t const* workers);
+void display_workers_run(struct display_workers_t* workers,int rows,
+                         display_stripe_func_t func,void* arg);
+
+/*
+ * Scale all of src onto all of dst, converting the format on the way,
+ * but only write the pixels of dst inside dst_rect (NULL for all of it).
+ * Returns -1 for formats it can't handle.
+ */
+int  display_scale(struct display_workers_t* workers,
+                   const struct display_surface_t* dst,const struct display_surface_t* src,
+                   const struct display_rect_t* dst_rect,int filter);
+
+/*
+ * Times the same scale on the blitter: ns per frame for an 800x480
+ * frame in format (DISPLAY_SCALE_*) stretched to width x height, or -1
+ * when it can't be timed.
+ */
+typedef int64_t (*display_scale_benchfunc_t)(void* arg,int width,int height,int format);
+
+/*
+ * Log how long display_scale takes for an 800x480 RGB565 and 8888 frame
+ * scaled to 720p and 1080p, with both filters, next to what hwfunc
+ * measures for the same sizes (NULL to leave it out).
+ */
+void display_scale_benchmark(struct display_workers_t* workers,
+                             display_scale_benchfunc_t hwfunc,void* hwarg);
+
+#endif /* DISPLAY_SCALE_H_ */
@@ -24,10 +24,13 @@ LOCAL_MODULE_TAGS := optional
 LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE)
 
 LOCAL_SRC_FILES := 	\
 	gralloc.cpp 	\
 	framebuffer.cpp \
+	fbcopy.cpp \
+	fbblit.cpp \
 	mapper.cpp
 	
 LOCAL_MODULE := gralloc.sun4i
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2026 The sun4i gralloc HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <cutils/log.h>
+
+#include <g2d_driver.h>
+
+#include "fbblit.h"
+
+/*****************************************************************************/
+
+static int g2d_format(int bpp)
+{
+    // a plain copy doesn't care about the channel order
+    return (bpp == 16) ? G2D_FMT_RGB565 : G2D_FMT_ARGB_AYUV8888;
+}
+
+static void g2d_setup_image(g2d_image* image, fb_surface_t const* s)
+{
+    image->addr[0]   = s->phys;
+    image->addr[1]   = 0;
+    image->addr[2]   = 0;
+    image->w         = s->stride;
+    image->h         = s->height;
+    image->format    = (g2d_data_fmt)g2d_format(s->bpp);
+    image->pixel_seq = G2D_SEQ_NORMAL;
+}
+
+int fb_blit_open()
+{
+    int fd = open("/dev/g2d", O_RDWR, 0);
+    if (fd < 0)
+        return -errno;
+    return fd;
+}
+
+int fb_blit_copy(int fd,
+        fb_surface_t const* dst, int x, int y,
+        fb_surface_t const* src, int l, int t, int w, int h)
+{
+    if (fd < 0 || dst->bpp != src->bpp)
+        return -EINVAL;
+
+    g2d_blt blit;
+    memset(&blit, 0, sizeof(blit));
+    blit.flag = G2D_BLT_NONE;
+    g2d_setup_image(&blit.src_image, src);
+    blit.src_rect.x = l;
+    blit.src_rect.y = t;
+    blit.src_rect.w = w;
+    blit.src_rect.h = h;
+    g2d_setup_image(&blit.dst_image, dst);
+    blit.dst_x = x;
+    blit.dst_y = y;
+    blit.alpha = 0xff;
+    if (ioctl(fd, G2D_CMD_BITBLT, (unsigned long)&blit) < 0)
+        return -errno;
+    return 0;
+}
+
+int fb_blit_rotate(int fd, fb_surface_t const* dst,
+        fb_surface_t const* src, int w, int h, int rotation)
+{
+    if (fd < 0 || dst->bpp != src->bpp)
+        return -EINVAL;
+
+    g2d_blt blit;
+    memset(&blit, 0, sizeof(blit));
+    switch (rotation) {
+        case 90:  blit.flag = G2D_BLT_ROTATE90;  break;
+        case 180: blit.flag = G2D_BLT_ROTATE180; break;
+        case 270: blit.flag = G2D_BLT_ROTATE270; break;
+        default:  return -EINVAL;
+    }
+    g2d_setup_image(&blit.src_image, src);
+    blit.src_rect.x = 0;
+    blit.src_rect.y = 0;
+    blit.src_rect.w = w;
+    blit.src_rect.h = h;
+    g2d_setup_image(&blit.dst_image, dst);
+    blit.dst_x = 0;
+    blit.dst_y = 0;
+    blit.alpha = 0xff;
+    if (ioctl(fd, G2D_CMD_BITBLT, (unsigned long)&blit) < 0)
+        return -errno;
+    return 0;
+}
+
+int fb_blit_stretch(int fd,
+        fb_surface_t const* dst, int dx, int dy, int dw, int dh,
+        fb_surface_t const* src, int sx, int sy, int sw, int sh)
+{
+    if (fd < 0 || dst->bpp != src->bpp)
+        return -EINVAL;
+
+    g2d_stretchblt blit;
+    memset(&blit, 0, sizeof(blit));
+    blit.flag = G2D_BLT_NONE;
+    g2d_setup_image(&blit.src_image, src);
+    blit.src_rect.x = sx;
+    blit.src_rect.y = sy;
+    blit.src_rect.w = sw;
+    blit.src_rect.h = sh;
+    g2d_setup_image(&blit.dst_image, dst);
+    blit.dst_rect.x = dx;
+    blit.dst_rect.y = dy;
+    blit.dst_rect.w = dw;
+    blit.dst_rect.h = dh;
+    blit.alpha = 0xff;
+    if (ioctl(fd, G2D_CMD_STRETCHBLT, (unsigned long)&blit) < 0)
+        return -errno;
+    return 0;
+}
+
+int fb_blit_fill(int fd, fb_surface_t const* dst,
+        int x, int y, int w, int h, uint32_t color)
+{
+    if (fd < 0)
+        return -EINVAL;
+
+    g2d_fillrect fill;
+    memset(&fill, 0, sizeof(fill));
+    fill.flag = G2D_FIL_NONE;
+    g2d_setup_image(&fill.dst_image, dst);
+    fill.dst_rect.x = x;
+    fill.dst_rect.y = y;
+    fill.dst_rect.w = w;
+    fill.dst_rect.h = h;
+    fill.color = color;
+    fill.alpha = 0xff;
+    if (ioctl(fd, G2D_CMD_FILLRECT, (unsigned long)&fill) < 0)
+        return -errno;
+    return 0;
+}
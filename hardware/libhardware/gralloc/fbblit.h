@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2026 The sun4i gralloc HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FBBLIT_H_
+#define FBBLIT_H_
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+/*****************************************************************************/
+
+/*
+ * A physically contiguous surface the G2D blitter can reach, i.e. a
+ * region of framebuffer memory.
+ */
+struct fb_surface_t {
+    uint32_t    phys;       // physical address of the first pixel
+    int         stride;     // in pixels
+    int         height;     // in lines
+    int         bpp;        // bits per pixel, 16 or 32
+};
+
+/* returns an fd for /dev/g2d, or a negative errno */
+int fb_blit_open();
+
+/*
+ * Copy the w x h rect at (l,t) in src to (x,y) in dst. Both surfaces must
+ * have the same depth. Returns 0 or a negative errno, in which case the
+ * caller is expected to fall back to the CPU.
+ */
+int fb_blit_copy(int fd,
+        fb_surface_t const* dst, int x, int y,
+        fb_surface_t const* src, int l, int t, int w, int h);
+
+/*
+ * Rotate the w x h top-left rect of src clockwise by 'rotation' degrees
+ * (90, 180 or 270) into the top-left corner of dst.
+ */
+int fb_blit_rotate(int fd, fb_surface_t const* dst,
+        fb_surface_t const* src, int w, int h, int rotation);
+
+/*
+ * Scale the sw x sh rect at (sx,sy) in src into the dw x dh rect at
+ * (dx,dy) in dst. Both surfaces must have the same depth.
+ */
+int fb_blit_stretch(int fd,
+        fb_surface_t const* dst, int dx, int dy, int dw, int dh,
+        fb_surface_t const* src, int sx, int sy, int sw, int sh);
+
+/* fill the w x h rect at (x,y) in dst with a raw pixel value */
+int fb_blit_fill(int fd, fb_surface_t const* dst,
+        int x, int y, int w, int h, uint32_t color);
+
+#endif /* FBBLIT_H_ */
@@ -0,0 +1,713 @@
+/*
+ * Copyright (C) 2026 The sun4i gralloc HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "gr.h"
+#include "fbcopy.h"
+
+/*****************************************************************************/
+
+// never split into more bands than this
+#define MAX_WORKERS     4
+
+// how far ahead of the loads we prefetch, in bytes
+#define PREFETCH_AHEAD  256
+
+// multiplier of the per-lane hash
+#define HASH_PRIME      0x01000193
+
+// side of the square tiles transposes are done in, in pixels
+#define ROTATE_TILE     32
+
+struct fb_worker_t {
+    fb_workers_t*   pool;
+    int             index;
+    pthread_t       thread;
+};
+
+struct fb_workers_t {
+    int             numThreads;     // including the calling thread
+    fb_worker_t     workers[MAX_WORKERS];
+    pthread_mutex_t lock;
+    pthread_cond_t  start;
+    pthread_cond_t  done;
+    uint32_t        generation;
+    int             pending;
+    bool            exiting;
+
+    // the job being run
+    fb_band_func_t  func;
+    void*           arg;
+    int             rows;
+};
+
+static inline void band_of(int rows, int n, int i, int* first, int* count)
+{
+    *first = (int)(((int64_t)rows * i) / n);
+    *count = (int)(((int64_t)rows * (i + 1)) / n) - *first;
+}
+
+static void* fb_worker_main(void* data)
+{
+    fb_worker_t* w = (fb_worker_t*)data;
+    fb_workers_t* pool = w->pool;
+    uint32_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->exiting && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->exiting)
+            break;
+        seen = pool->generation;
+        fb_band_func_t func = pool->func;
+        void* arg = pool->arg;
+        int first, count;
+        band_of(pool->rows, pool->numThreads, w->index, &first, &count);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (count > 0)
+            func(arg, first, count);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+fb_workers_t* fb_workers_create(int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads <= 0)
+        numThreads = 1;
+    if (numThreads > MAX_WORKERS)
+        numThreads = MAX_WORKERS;
+
+    fb_workers_t* pool = (fb_workers_t*)malloc(sizeof(*pool));
+    if (!pool)
+        return 0;
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, 0);
+    pthread_cond_init(&pool->start, 0);
+    pthread_cond_init(&pool->done, 0);
+    pool->numThreads = 1;
+
+    // worker 0 is the caller
+    for (int i=1 ; i<numThreads ; i++) {
+        fb_worker_t* w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        if (pthread_create(&w->thread, 0, fb_worker_main, w)) {
+            LOGW("couldn't start copy worker %d, using %d thread(s)",
+                    i, pool->numThreads);
+            break;
+        }
+        pool->numThreads++;
+    }
+    return pool;
+}
+
+void fb_workers_destroy(fb_workers_t* pool)
+{
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->exiting = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i=1 ; i<pool->numThreads ; i++)
+        pthread_join(pool->workers[i].thread, 0);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int fb_workers_count(fb_workers_t const* pool)
+{
+    return pool ? pool->numThreads : 1;
+}
+
+void fb_workers_run(fb_workers_t* pool, int rows,
+        fb_band_func_t func, void* arg)
+{
+    if (rows <= 0)
+        return;
+    if (!pool || pool->numThreads == 1 || rows < pool->numThreads) {
+        func(arg, 0, rows);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->func = func;
+    pool->arg = arg;
+    pool->rows = rows;
+    pool->pending = pool->numThreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    int first, count;
+    band_of(rows, pool->numThreads, 0, &first, &count);
+    func(arg, first, count);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*****************************************************************************/
+
+static inline void copy_row(uint8_t* d, uint8_t const* s, size_t n)
+{
+#if defined(__ARM_NEON__)
+    while (n >= 64) {
+        __builtin_prefetch(s + PREFETCH_AHEAD);
+        uint8x16_t a = vld1q_u8(s);
+        uint8x16_t b = vld1q_u8(s + 16);
+        uint8x16_t c = vld1q_u8(s + 32);
+        uint8x16_t e = vld1q_u8(s + 48);
+        vst1q_u8(d,      a);
+        vst1q_u8(d + 16, b);
+        vst1q_u8(d + 32, c);
+        vst1q_u8(d + 48, e);
+        s += 64;
+        d += 64;
+        n -= 64;
+    }
+#endif
+    if (n)
+        memcpy(d, s, n);
+}
+
+void fb_copy_rows(void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        size_t bytes, int rows)
+{
+    uint8_t* d = (uint8_t*)dst;
+    uint8_t const* s = (uint8_t const*)src;
+
+    if (dstStride == bytes && srcStride == bytes) {
+        // both surfaces are packed, copy it as one long row
+        copy_row(d, s, bytes * rows);
+        return;
+    }
+    for (int y=0 ; y<rows ; y++) {
+        copy_row(d, s, bytes);
+        d += dstStride;
+        s += srcStride;
+    }
+}
+
+struct copy_job_t {
+    uint8_t*        dst;
+    size_t          dstStride;
+    uint8_t const*  src;
+    size_t          srcStride;
+    size_t          bytes;
+};
+
+static void copy_band(void* arg, int first, int count)
+{
+    copy_job_t const* job = (copy_job_t const*)arg;
+    fb_copy_rows(job->dst + first * job->dstStride, job->dstStride,
+            job->src + first * job->srcStride, job->srcStride,
+            job->bytes, count);
+}
+
+void fb_copy(fb_workers_t* workers,
+        void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        size_t bytes, int rows)
+{
+    copy_job_t job;
+    job.dst = (uint8_t*)dst;
+    job.dstStride = dstStride;
+    job.src = (uint8_t const*)src;
+    job.srcStride = srcStride;
+    job.bytes = bytes;
+    fb_workers_run(workers, rows, copy_band, &job);
+}
+
+/*****************************************************************************/
+
+// 4x4 ordered dither thresholds, 0..15
+static const uint8_t sBayer[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+};
+
+static inline uint8_t add_sat(uint8_t a, uint8_t b)
+{
+    const int v = a + b;
+    return v > 255 ? 255 : uint8_t(v);
+}
+
+static inline void convert_row(uint16_t* d, uint8_t const* s,
+        int x, int y, int n)
+{
+    // thresholds for 8 pixels, scaled to the bits each channel loses
+    uint8_t t5[8], t6[8];
+    uint8_t const* pattern = sBayer[y & 3];
+    for (int i=0 ; i<8 ; i++) {
+        t5[i] = pattern[(x + i) & 3] >> 1;
+        t6[i] = pattern[(x + i) & 3] >> 2;
+    }
+
+#if defined(__ARM_NEON__)
+    const uint8x8_t d5 = vld1_u8(t5);
+    const uint8x8_t d6 = vld1_u8(t6);
+    while (n >= 8) {
+        __builtin_prefetch(s + PREFETCH_AHEAD);
+        uint8x8x4_t p = vld4_u8(s);     // b, g, r, a
+        uint8x8_t r = vqadd_u8(p.val[2], d5);
+        uint8x8_t g = vqadd_u8(p.val[1], d6);
+        uint8x8_t b = vqadd_u8(p.val[0], d5);
+        uint16x8_t v = vshll_n_u8(r, 8);
+        v = vsriq_n_u16(v, vshll_n_u8(g, 8), 5);
+        v = vsriq_n_u16(v, vshll_n_u8(b, 8), 11);
+        vst1q_u16(d, v);
+        s += 32;
+        d += 8;
+        n -= 8;
+    }
+#endif
+    // the pattern repeats every 4 pixels, so it still lines up here
+    for (int i=0 ; i<n ; i++) {
+        const uint8_t b = add_sat(s[0], t5[i & 7]);
+        const uint8_t g = add_sat(s[1], t6[i & 7]);
+        const uint8_t r = add_sat(s[2], t5[i & 7]);
+        d[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        s += 4;
+    }
+}
+
+void fb_convert_rows_565(void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        int x, int y, int width, int rows)
+{
+    uint8_t* d = (uint8_t*)dst;
+    uint8_t const* s = (uint8_t const*)src;
+    for (int i=0 ; i<rows ; i++) {
+        convert_row((uint16_t*)d, s, x, y + i, width);
+        d += dstStride;
+        s += srcStride;
+    }
+}
+
+struct convert_job_t {
+    uint8_t*        dst;
+    size_t          dstStride;
+    uint8_t const*  src;
+    size_t          srcStride;
+    int             x;
+    int             y;
+    int             width;
+};
+
+static void convert_band(void* arg, int first, int count)
+{
+    convert_job_t const* job = (convert_job_t const*)arg;
+    fb_convert_rows_565(job->dst + first * job->dstStride, job->dstStride,
+            job->src + first * job->srcStride, job->srcStride,
+            job->x, job->y + first, job->width, count);
+}
+
+void fb_convert_565(fb_workers_t* workers,
+        void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        int x, int y, int width, int rows)
+{
+    convert_job_t job;
+    job.dst = (uint8_t*)dst;
+    job.dstStride = dstStride;
+    job.src = (uint8_t const*)src;
+    job.srcStride = srcStride;
+    job.x = x;
+    job.y = y;
+    job.width = width;
+    fb_workers_run(workers, rows, convert_band, &job);
+}
+
+/*****************************************************************************/
+
+/*
+ * Transpose 4x4 pixels: dst row i is src column i. Strides are in bytes
+ * and may be negative.
+ */
+static inline void transpose4_32(uint8_t* d, ptrdiff_t ds,
+        uint8_t const* s, ptrdiff_t ss)
+{
+#if defined(__ARM_NEON__)
+    uint32x4_t r0 = vld1q_u32((uint32_t const*)(s));
+    uint32x4_t r1 = vld1q_u32((uint32_t const*)(s + ss));
+    uint32x4_t r2 = vld1q_u32((uint32_t const*)(s + ss * 2));
+    uint32x4_t r3 = vld1q_u32((uint32_t const*)(s + ss * 3));
+    uint32x4x2_t t01 = vtrnq_u32(r0, r1);
+    uint32x4x2_t t23 = vtrnq_u32(r2, r3);
+    vst1q_u32((uint32_t*)(d),          vcombine_u32(
+            vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])));
+    vst1q_u32((uint32_t*)(d + ds),     vcombine_u32(
+            vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])));
+    vst1q_u32((uint32_t*)(d + ds * 2), vcombine_u32(
+            vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])));
+    vst1q_u32((uint32_t*)(d + ds * 3), vcombine_u32(
+            vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])));
+#else
+    for (int y=0 ; y<4 ; y++)
+        for (int x=0 ; x<4 ; x++)
+            ((uint32_t*)(d + y * ds))[x] = ((uint32_t const*)(s + x * ss))[y];
+#endif
+}
+
+static inline void transpose4_16(uint8_t* d, ptrdiff_t ds,
+        uint8_t const* s, ptrdiff_t ss)
+{
+#if defined(__ARM_NEON__)
+    uint16x4_t r0 = vld1_u16((uint16_t const*)(s));
+    uint16x4_t r1 = vld1_u16((uint16_t const*)(s + ss));
+    uint16x4_t r2 = vld1_u16((uint16_t const*)(s + ss * 2));
+    uint16x4_t r3 = vld1_u16((uint16_t const*)(s + ss * 3));
+    uint16x4x2_t t01 = vtrn_u16(r0, r1);
+    uint16x4x2_t t23 = vtrn_u16(r2, r3);
+    uint32x2x2_t u0 = vtrn_u32(vreinterpret_u32_u16(t01.val[0]),
+            vreinterpret_u32_u16(t23.val[0]));
+    uint32x2x2_t u1 = vtrn_u32(vreinterpret_u32_u16(t01.val[1]),
+            vreinterpret_u32_u16(t23.val[1]));
+    vst1_u16((uint16_t*)(d),          vreinterpret_u16_u32(u0.val[0]));
+    vst1_u16((uint16_t*)(d + ds),     vreinterpret_u16_u32(u1.val[0]));
+    vst1_u16((uint16_t*)(d + ds * 2), vreinterpret_u16_u32(u0.val[1]));
+    vst1_u16((uint16_t*)(d + ds * 3), vreinterpret_u16_u32(u1.val[1]));
+#else
+    for (int y=0 ; y<4 ; y++)
+        for (int x=0 ; x<4 ; x++)
+            ((uint16_t*)(d + y * ds))[x] = ((uint16_t const*)(s + x * ss))[y];
+#endif
+}
+
+/*
+ * dst(x, y) = src(y, x) for a 'width' x 'height' dst, in tiles. Negative
+ * strides turn the transpose into a rotation.
+ */
+static void transpose(uint8_t* dst, ptrdiff_t ds,
+        uint8_t const* src, ptrdiff_t ss,
+        int width, int height, int bpp)
+{
+    for (int ty=0 ; ty<height ; ty+=ROTATE_TILE) {
+        const int th = (height - ty < ROTATE_TILE) ? height - ty : ROTATE_TILE;
+        for (int tx=0 ; tx<width ; tx+=ROTATE_TILE) {
+            const int tw = (width - tx < ROTATE_TILE) ? width - tx : ROTATE_TILE;
+            const int bh = th & ~3;
+            const int bw = tw & ~3;
+            for (int y=ty ; y<ty+bh ; y+=4) {
+                uint8_t* d = dst + y * ds + tx * bpp;
+                uint8_t const* s = src + tx * ss + y * bpp;
+                for (int x=0 ; x<bw ; x+=4) {
+                    if (bpp == 4)
+                        transpose4_32(d, ds, s, ss);
+                    else
+                        transpose4_16(d, ds, s, ss);
+                    d += 4 * bpp;
+                    s += 4 * ss;
+                }
+            }
+            // ragged right and bottom edges of the tile
+            for (int y=ty ; y<ty+th ; y++) {
+                const int x0 = (y < ty + bh) ? bw : 0;
+                for (int x=tx+x0 ; x<tx+tw ; x++) {
+                    if (bpp == 4) {
+                        ((uint32_t*)(dst + y * ds))[x] =
+                                ((uint32_t const*)(src + x * ss))[y];
+                    } else {
+                        ((uint16_t*)(dst + y * ds))[x] =
+                                ((uint16_t const*)(src + x * ss))[y];
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void reverse_row(uint8_t* d, uint8_t const* s, int n, int bpp)
+{
+    // s points past the end of the source row
+    if (bpp == 4) {
+        uint32_t* d32 = (uint32_t*)d;
+        uint32_t const* s32 = (uint32_t const*)s;
+#if defined(__ARM_NEON__)
+        for ( ; n >= 4 ; n -= 4) {
+            s32 -= 4;
+            uint32x4_t v = vrev64q_u32(vld1q_u32(s32));
+            vst1q_u32(d32, vcombine_u32(vget_high_u32(v), vget_low_u32(v)));
+            d32 += 4;
+        }
+#endif
+        while (n--)
+            *d32++ = *--s32;
+    } else {
+        uint16_t* d16 = (uint16_t*)d;
+        uint16_t const* s16 = (uint16_t const*)s;
+#if defined(__ARM_NEON__)
+        for ( ; n >= 8 ; n -= 8) {
+            s16 -= 8;
+            uint16x8_t v = vrev64q_u16(vld1q_u16(s16));
+            vst1q_u16(d16, vcombine_u16(vget_high_u16(v), vget_low_u16(v)));
+            d16 += 8;
+        }
+#endif
+        while (n--)
+            *d16++ = *--s16;
+    }
+}
+
+struct rotate_job_t {
+    uint8_t*        dst;
+    size_t          dstStride;
+    uint8_t const*  src;
+    size_t          srcStride;
+    int             width;      // of the source
+    int             height;
+    int             bpp;
+    int             rotation;
+};
+
+static void rotate_band(void* arg, int first, int count)
+{
+    rotate_job_t const* job = (rotate_job_t const*)arg;
+    const ptrdiff_t ds = job->dstStride;
+    const ptrdiff_t ss = job->srcStride;
+    const int bpp = job->bpp;
+
+    switch (job->rotation) {
+    case 90:
+        // dst row y is source column y, read bottom to top
+        transpose(job->dst + first * ds, ds,
+                job->src + (job->height - 1) * ss + first * bpp, -ss,
+                job->height, count, bpp);
+        break;
+    case 180:
+        for (int y=first ; y<first+count ; y++) {
+            reverse_row(job->dst + y * ds,
+                    job->src + (job->height - 1 - y) * ss + job->width * bpp,
+                    job->width, bpp);
+        }
+        break;
+    case 270:
+        // dst row y is source column width-1-y, read top to bottom
+        transpose(job->dst + (first + count - 1) * ds, -ds,
+                job->src + (job->width - first - count) * bpp, ss,
+                job->height, count, bpp);
+        break;
+    }
+}
+
+void fb_rotate(fb_workers_t* workers,
+        void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        int width, int height, int bytesPerPixel, int rotation)
+{
+    rotate_job_t job;
+    job.dst = (uint8_t*)dst;
+    job.dstStride = dstStride;
+    job.src = (uint8_t const*)src;
+    job.srcStride = srcStride;
+    job.width = width;
+    job.height = height;
+    job.bpp = bytesPerPixel;
+    job.rotation = rotation;
+    fb_workers_run(workers, (rotation == 180) ? height : width,
+            rotate_band, &job);
+}
+
+/*****************************************************************************/
+
+void fb_scale_nearest(void* dst, size_t dstStride, int dw, int dh,
+        void const* src, size_t srcStride, int sw, int sh,
+        int bytesPerPixel)
+{
+    if (dw <= 0 || dh <= 0)
+        return;
+    // 16.16 steps, sampling the middle of each destination pixel
+    const uint32_t xstep = (uint32_t(sw) << 16) / dw;
+    const uint32_t ystep = (uint32_t(sh) << 16) / dh;
+    uint32_t sy = ystep / 2;
+    for (int y=0 ; y<dh ; y++, sy += ystep) {
+        uint8_t const* s = (uint8_t const*)src + (sy >> 16) * srcStride;
+        uint8_t* d = (uint8_t*)dst + y * dstStride;
+        uint32_t sx = xstep / 2;
+        if (bytesPerPixel == 4) {
+            for (int x=0 ; x<dw ; x++, sx += xstep)
+                ((uint32_t*)d)[x] = ((uint32_t const*)s)[sx >> 16];
+        } else {
+            for (int x=0 ; x<dw ; x++, sx += xstep)
+                ((uint16_t*)d)[x] = ((uint16_t const*)s)[sx >> 16];
+        }
+    }
+}
+
+/*****************************************************************************/
+
+/*
+ * Four independent multiply-add hashes, one per 32-bit lane of each
+ * 16-byte chunk, so the NEON and C versions give the same result. Two
+ * lanes are folded into each half of the result.
+ */
+uint64_t fb_hash_rows(void const* src, size_t stride,
+        size_t bytes, int rows)
+{
+    uint8_t const* s = (uint8_t const*)src;
+    uint32_t tail = 0;
+
+#if defined(__ARM_NEON__)
+    const uint32x4_t prime = vdupq_n_u32(HASH_PRIME);
+    uint32x4_t acc = { 0x811c9dc5, 0x811c9dc6, 0x811c9dc7, 0x811c9dc8 };
+    for (int y=0 ; y<rows ; y++) {
+        uint8_t const* p = s + y * stride;
+        size_t n = bytes;
+        while (n >= 16) {
+            __builtin_prefetch(p + PREFETCH_AHEAD);
+            uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(p));
+            acc = vmlaq_u32(v, acc, prime);
+            p += 16;
+            n -= 16;
+        }
+        while (n--)
+            tail = tail * HASH_PRIME + *p++;
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, acc);
+#else
+    uint32_t lanes[4] = { 0x811c9dc5, 0x811c9dc6, 0x811c9dc7, 0x811c9dc8 };
+    for (int y=0 ; y<rows ; y++) {
+        uint8_t const* p = s + y * stride;
+        size_t n = bytes;
+        while (n >= 16) {
+            for (int i=0 ; i<4 ; i++) {
+                uint32_t v;
+                memcpy(&v, p + i * 4, 4);
+                lanes[i] = lanes[i] * HASH_PRIME + v;
+            }
+            p += 16;
+            n -= 16;
+        }
+        while (n--)
+            tail = tail * HASH_PRIME + *p++;
+    }
+#endif
+    return ((uint64_t)(lanes[0] * HASH_PRIME + lanes[1]) << 32) |
+            (uint32_t)(lanes[2] * HASH_PRIME + lanes[3] + tail);
+}
+
+/*****************************************************************************/
+
+void fb_copy_benchmark(fb_workers_t* workers,
+        size_t bytes, size_t stride, int rows)
+{
+    const int iterations = 30;
+    const size_t size = stride * rows;
+    uint8_t* src = (uint8_t*)malloc(size);
+    uint8_t* dst = (uint8_t*)malloc(size);
+    if (!src || !dst) {
+        free(src);
+        free(dst);
+        return;
+    }
+    for (size_t i=0 ; i<size ; i++)
+        src[i] = uint8_t(i * 7);
+    memset(dst, 0, size);
+
+    // memcpy of the whole surface is what fb_post used to do
+    int64_t t0 = now_ns();
+    for (int i=0 ; i<iterations ; i++)
+        memcpy(dst, src, size);
+    int64_t t1 = now_ns();
+    for (int i=0 ; i<iterations ; i++)
+        fb_copy_rows(dst, stride, src, stride, bytes, rows);
+    int64_t t2 = now_ns();
+    for (int i=0 ; i<iterations ; i++)
+        fb_copy(workers, dst, stride, src, stride, bytes, rows);
+    int64_t t3 = now_ns();
+
+    const double mb = double(bytes) * rows * iterations / (1024.0 * 1024.0);
+    LOGI("fb copy benchmark (%ux%d bytes, stride %u, %d iterations)\n"
+         "memcpy       = %7.1f MB/s (%.2f ms/frame)\n"
+         "fb_copy_rows = %7.1f MB/s (%.2f ms/frame)\n"
+         "fb_copy x%d   = %7.1f MB/s (%.2f ms/frame)\n",
+            (unsigned)bytes, rows, (unsigned)stride, iterations,
+            mb * 1e9 / (t1 - t0), (t1 - t0) / (1e6 * iterations),
+            mb * 1e9 / (t2 - t1), (t2 - t1) / (1e6 * iterations),
+            fb_workers_count(workers),
+            mb * 1e9 / (t3 - t2), (t3 - t2) / (1e6 * iterations));
+
+    free(src);
+    free(dst);
+}
+
+void fb_convert_benchmark(fb_workers_t* workers,
+        int width, int rows)
+{
+    const int iterations = 30;
+    const size_t srcStride = width * 4;
+    const size_t dstStride = width * 2;
+    uint8_t* src = (uint8_t*)malloc(srcStride * rows);
+    uint8_t* dst = (uint8_t*)malloc(srcStride * rows);
+    if (!src || !dst) {
+        free(src);
+        free(dst);
+        return;
+    }
+    for (size_t i=0 ; i<srcStride * rows ; i++)
+        src[i] = uint8_t(i * 7);
+    memset(dst, 0, srcStride * rows);
+
+    int64_t t0 = now_ns();
+    for (int i=0 ; i<iterations ; i++)
+        fb_copy(workers, dst, srcStride, src, srcStride, srcStride, rows);
+    int64_t t1 = now_ns();
+    for (int i=0 ; i<iterations ; i++)
+        fb_convert_565(workers, dst, dstStride, src, srcStride,
+                0, 0, width, rows);
+    int64_t t2 = now_ns();
+
+    // bytes read and written, the copy moves 4+4 per pixel, the conversion 4+2
+    const double mb = double(width) * rows * iterations / (1024.0 * 1024.0);
+    LOGI("fb convert benchmark (%dx%d, %d iterations, x%d)\n"
+         "8888 copy          = %.2f ms/frame (%7.1f MB/s)\n"
+         "8888 -> 565 dither = %.2f ms/frame (%7.1f MB/s)\n",
+            width, rows, iterations, fb_workers_count(workers),
+            (t1 - t0) / (1e6 * iterations), mb * 8 * 1e9 / (t1 - t0),
+            (t2 - t1) / (1e6 * iterations), mb * 6 * 1e9 / (t2 - t1));
+
+    free(src);
+    free(dst);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2026 The sun4i gralloc HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FBCOPY_H_
+#define FBCOPY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/cdefs.h>
+
+/*****************************************************************************/
+
+/*
+ * Pool of worker threads that split a per-row job into horizontal bands.
+ * The calling thread always takes the first band itself, so a pool
+ * created with a single thread runs everything inline.
+ */
+struct fb_workers_t;
+
+typedef void (*fb_band_func_t)(void* arg, int first, int count);
+
+fb_workers_t* fb_workers_create(int numThreads);
+void fb_workers_destroy(fb_workers_t* workers);
+int fb_workers_count(fb_workers_t const* workers);
+void fb_workers_run(fb_workers_t* workers, int rows,
+        fb_band_func_t func, void* arg);
+
+/*****************************************************************************/
+
+/*
+ * Copy 'rows' rows of 'bytes' bytes each, honoring the source and
+ * destination pitch. Uses NEON streaming loads/stores when available.
+ */
+void fb_copy_rows(void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        size_t bytes, int rows);
+
+/* same as fb_copy_rows, split across the pool */
+void fb_copy(fb_workers_t* workers,
+        void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        size_t bytes, int rows);
+
+/*
+ * Convert 'rows' rows of 'width' BGRA_8888 pixels to RGB_565 with a 4x4
+ * ordered dither. (x, y) is the screen position of the first pixel, so
+ * that the dither pattern stays put when only part of the screen is
+ * converted.
+ */
+void fb_convert_rows_565(void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        int x, int y, int width, int rows);
+
+/* same as fb_convert_rows_565, split across the pool */
+void fb_convert_565(fb_workers_t* workers,
+        void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        int x, int y, int width, int rows);
+
+/*
+ * Rotate a 'width' x 'height' surface of 2 or 4 byte pixels clockwise by
+ * 'rotation' degrees (90, 180 or 270) into dst, split across the pool.
+ * dst is height x width for 90 and 270. The transposes go through the
+ * surfaces in small tiles so that both sides stay in the cache.
+ */
+void fb_rotate(fb_workers_t* workers,
+        void* dst, size_t dstStride,
+        void const* src, size_t srcStride,
+        int width, int height, int bytesPerPixel, int rotation);
+
+/*
+ * Nearest-neighbour scale of a 'sw' x 'sh' surface of 2 or 4 byte pixels
+ * into 'dw' x 'dh'. Only reads the pixels it keeps, in a single thread.
+ */
+void fb_scale_nearest(void* dst, size_t dstStride, int dw, int dh,
+        void const* src, size_t srcStride, int sw, int sh,
+        int bytesPerPixel);
+
+/*
+ * 64-bit content hash of 'rows' rows of 'bytes' bytes. Only meant to
+ * tell two frames apart, not to resist anyone making them collide.
+ */
+uint64_t fb_hash_rows(void const* src, size_t stride,
+        size_t bytes, int rows);
+
+/*
+ * Log the throughput of memcpy, fb_copy_rows and fb_copy for a
+ * surface of the given geometry (run from fb_device_open when
+ * debug.gralloc.copy_bench is set).
+ */
+void fb_copy_benchmark(fb_workers_t* workers,
+        size_t bytes, size_t stride, int rows);
+
+/*
+ * Log the cost of a 32-bit copy against a dithered conversion to 565,
+ * and the memory traffic each of them measured.
+ */
+void fb_convert_benchmark(fb_workers_t* workers,
+        int width, int rows);
+
+#endif /* FBCOPY_H_ */
@@ -27,11 +27,13 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #if HAVE_ANDROID_OS
 #include <linux/fb.h>
@@ -39,20 +41,122 @@
 
 #include "gralloc_priv.h"
 #include "gr.h"
+#include "fbcopy.h"
+#include "fbblit.h"
 
 /*****************************************************************************/
 
 // numbers of buffers for page flipping
 #define NUM_BUFFERS 2
 
+// lines copied between two checks of the beam position
+#define CHASE_BAND_LINES 16
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, __u32)
+#endif
+
+// posts remembered for the dump
+#define FRAME_HISTORY 64
+
+// posts listed by the dump, it has to fit in the caller's buffer
+#define FRAME_DUMP 16
+
+// present intervals, in refresh periods: <1, 1, 2, 3, 4, 5 and more
+#define INTERVAL_BUCKETS 6
+
+// time spent in fb_post and from post to latch, in ms:
+// <1, <2, <4, <8, <16, <32, 32 and more
+#define DURATION_BUCKETS 7
+
+// an interval longer than this is the screen being idle, not jank
+#define IDLE_NS 200000000LL
 
 enum {
-    PAGE_FLIP = 0x00000001,
-    LOCKED = 0x00000002
+    POST_PAN = 0,
+    POST_PUT,
+    POST_COPY,
+    POST_BLIT,
+    POST_SKIP
+};
+
+struct fb_frame_t {
+    int64_t     start;      // fb_post entry
+    int64_t     done;       // fb_post completion
+    int         path;
+};
+
+struct fb_timing_t {
+    pthread_mutex_t lock;
+    fb_frame_t      frames[FRAME_HISTORY];
+    uint32_t        numFrames;
+    int64_t         lastDone;
+    uint32_t        intervals[INTERVAL_BUCKETS];
+    uint32_t        durations[DURATION_BUCKETS];
+    uint32_t        numIdle;
+    uint32_t        missedVsyncs;
+    int64_t         maxInterval;
+    int64_t         maxDuration;
+    uint64_t        totalDuration;
+    /*
+     * Post to latch: a thread waits for the vsync after each post and
+     * counts from fb_post entry to it. A post that comes in while the
+     * thread is already waiting is counted to the vsync after, so the
+     * latency can be over by one period when posts pile up.
+     */
+    bool            latchRunning;
+    bool            latchExiting;
+    pthread_t       latchThread;
+    pthread_cond_t  latchCond;
+    int64_t         latchPending;   // entry of the post to latch, 0 if none
+    uint32_t        numLatched;
+    uint32_t        latencies[DURATION_BUCKETS];
+    int64_t         maxLatency;
+    uint64_t        totalLatency;
+};
+
+
+/*
+ * Drops the refresh rate when nothing was posted for a while, by
+ * stretching the vertical front porch so the pixel clock doesn't change.
+ * The lock is held across posts so the thread never switches under one.
+ */
+struct fb_idle_t {
+    bool            running;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            exiting;
+    int64_t         timeout;        // 0 once dropping the rate failed
+    int64_t         lastPost;
+    bool            idle;
+    uint32_t        failedRestores; // in a row, retried on every post
+    uint32_t        activeMargin;   // lower_margin at each rate
+    uint32_t        idleMargin;
+    float           idleFps;
+    // how long at each rate, for the log and the dump
+    int64_t         since;
+    int64_t         timeActive;
+    int64_t         timeIdle;
+    uint32_t        numSwitches;
+    int64_t         maxRestore;
 };
 
 struct fb_context_t {
     framebuffer_device_t  device;
+    // splits the copy when we can't flip
+    fb_workers_t*         workers;
+    // damage for the next post, in pixels, empty when unknown
+    int                   updateLeft;
+    int                   updateTop;
+    int                   updateRight;
+    int                   updateBottom;
+    // content hash of what's on screen, to skip identical posts
+    uint64_t              screenHash;
+    bool                  screenHashValid;
+    // when and how the recent posts went, for dumpsys
+    fb_timing_t           timing;
+    fb_idle_t             idle;
 };
 
 /*****************************************************************************/
@@ -76,68 +180,818 @@ static int fb_setUpdateRect(struct framebuffer_device_t* dev,
     fb_context_t* ctx = (fb_context_t*)dev;
     private_module_t* m = reinterpret_cast<private_module_t*>(
             dev->common.module);
+    int r = l + w;
+    int b = t + h;
+    if (r > int(m->info.xres)) r = m->info.xres;
+    if (b > int(m->info.yres)) b = m->info.yres;
+    if (l >= r || t >= b)
+        return -EINVAL;
+
+    // only valid for the next post
+    ctx->updateLeft = l;
+    ctx->updateTop = t;
+    ctx->updateRight = r;
+    ctx->updateBottom = b;
+
     m->info.reserved[0] = 0x54445055; // "UPDT";
     m->info.reserved[1] = (uint16_t)l | ((uint32_t)t << 16);
-    m->info.reserved[2] = (uint16_t)(l+w) | ((uint32_t)(t+h) << 16);
+    m->info.reserved[2] = (uint16_t)r | ((uint32_t)b << 16);
     return 0;
 }
 
-static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
+static int fb_wait_vsync(private_module_t* m)
+{
+    uint32_t crtc = 0;
+    if (ioctl(m->framebuffer->fd, FBIO_WAITFORVSYNC, &crtc) == -1) {
+        int err = -errno;
+        LOGW("FBIO_WAITFORVSYNC failed (%s), no longer chasing the beam",
+                strerror(-err));
+        m->flags &= ~BEAM_CHASE;
+        return err;
+    }
+    return 0;
+}
+
+/*
+ * Start copying as soon as the vertical blank begins and go down the
+ * screen in bands. As long as the copy outruns the scanout, every line
+ * is written before the beam gets to it: the frame scanned out next is
+ * entirely new and shows up at the same vsync a flip would have.
+ *
+ * The bands are copied in order on this thread. Split across the pool
+ * they would finish in whatever order the workers get to them, and the
+ * top of the screen is the part the beam reaches first.
+ */
+static void fb_copy_chasing(fb_context_t* ctx, private_module_t* m,
+        uint8_t* dst, size_t dstStride,
+        uint8_t const* src, size_t srcStride,
+        size_t bytes, int top, int rows)
+{
+    if (fb_wait_vsync(m) < 0) {
+        fb_copy(ctx->workers, dst, dstStride, src, srcStride, bytes, rows);
+        return;
+    }
+
+    const int64_t vsync = now_ns();
+    const int64_t lineTime = m->lineTimeNs;
+    // the vsync pulse and back porch go by before the first visible line
+    const int blank = m->info.vsync_len + m->info.upper_margin;
+    bool late = false;
+    for (int y=0 ; y<rows ; y+=CHASE_BAND_LINES) {
+        int count = rows - y;
+        if (count > CHASE_BAND_LINES)
+            count = CHASE_BAND_LINES;
+        if (!late && lineTime) {
+            // the beam already went past this band, this frame will tear
+            if ((now_ns() - vsync) / lineTime > blank + top + y)
+                late = true;
+        }
+        fb_copy_rows(dst + y * dstStride, dstStride,
+                src + y * srcStride, srcStride, bytes, count);
+    }
+    if (late)
+        m->numLateChases++;
+}
+
+/*
+ * Posts are rendered in the rotated, logical orientation and turned
+ * around on their way to the front buffer. Always the whole frame.
+ */
+static void fb_post_rotated(fb_context_t* ctx, private_module_t* m,
+        private_handle_t const* hnd, buffer_handle_t buffer)
+{
+    const int64_t start = now_ns();
+    const int bpp = m->info.bits_per_pixel >> 3;
+    const bool swap = (m->rotation != 180);
+    const int w = swap ? m->info.yres : m->info.xres;
+    const int h = swap ? m->info.xres : m->info.yres;
+    const size_t srcStride = (w * bpp + 3) & ~3;
+
+    int err = -EINVAL;
+    if ((m->flags & BLIT_COPY) &&
+            (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)) {
+        fb_surface_t src, dst;
+        dst.phys = m->finfo.smem_start;
+        dst.stride = m->finfo.line_length / bpp;
+        dst.height = m->info.yres;
+        dst.bpp = m->info.bits_per_pixel;
+        src.phys = m->finfo.smem_start + hnd->offset;
+        src.stride = srcStride / bpp;
+        src.height = h;
+        src.bpp = m->info.bits_per_pixel;
+        err = fb_blit_rotate(m->g2dFd, &dst, &src, w, h, m->rotation);
+        if (err < 0) {
+            LOGW("G2D rotation failed (%s), rotating with the CPU",
+                    strerror(-err));
+            m->flags &= ~BLIT_COPY;
+        } else {
+            m->numBlits++;
+        }
+    }
+
+    if (err < 0) {
+        void* fb_vaddr;
+        void* buffer_vaddr;
+
+        m->base.lock(&m->base, m->framebuffer,
+                GRALLOC_USAGE_SW_WRITE_RARELY,
+                0, 0, m->info.xres, m->info.yres,
+                &fb_vaddr);
+
+        m->base.lock(&m->base, buffer,
+                GRALLOC_USAGE_SW_READ_RARELY,
+                0, 0, w, h,
+                &buffer_vaddr);
+
+        fb_rotate(ctx->workers, fb_vaddr, m->finfo.line_length,
+                buffer_vaddr, srcStride, w, h, bpp, m->rotation);
+
+        m->base.unlock(&m->base, buffer);
+        m->base.unlock(&m->base, m->framebuffer);
+    }
+    m->numCopies++;
+    m->numRotations++;
+    m->rotateTimeNs += now_ns() - start;
+}
+
+static int fb_post_buffer(struct framebuffer_device_t* dev,
+        buffer_handle_t buffer)
 {
     if (private_handle_t::validate(buffer) < 0)
         return -EINVAL;
 
     fb_context_t* ctx = (fb_context_t*)dev;
+    if (reinterpret_cast<private_handle_t const*>(buffer)->flags &
+            private_handle_t::PRIV_FLAGS_FB1)
+        return -EINVAL;
 
     private_handle_t const* hnd = reinterpret_cast<private_handle_t const*>(buffer);
     private_module_t* m = reinterpret_cast<private_module_t*>(
             dev->common.module);
 
-    if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) {
+    if ((hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) &&
+            (m->flags & PAGE_FLIP)) {
         const size_t offset = hnd->base - m->framebuffer->base;
         m->info.activate = FB_ACTIVATE_VBL;
         m->info.yoffset = offset / m->finfo.line_length;
+        if (m->flags & PAN_DISPLAY) {
+            // only the offsets changed, no need to re-validate the mode
+            if (ioctl(m->framebuffer->fd, FBIOPAN_DISPLAY, &m->info) == 0) {
+                m->numPanFlips++;
+                m->currentBuffer = buffer;
+                return 0;
+            }
+            LOGW("FBIOPAN_DISPLAY failed (%s), using FBIOPUT_VSCREENINFO",
+                    strerror(errno));
+            m->flags &= ~PAN_DISPLAY;
+        }
         if (ioctl(m->framebuffer->fd, FBIOPUT_VSCREENINFO, &m->info) == -1) {
             LOGE("FBIOPUT_VSCREENINFO failed");
             m->base.unlock(&m->base, buffer); 
             return -errno;
         }
+        m->numPutFlips++;
         m->currentBuffer = buffer;
         
+    } else if (m->rotation) {
+        fb_post_rotated(ctx, m, hnd, buffer);
     } else {
         // If we can't do the page_flip, just copy the buffer to the front 
-        // FIXME: use copybit HAL instead of memcpy
-        
-        void* fb_vaddr;
-        void* buffer_vaddr;
-        
-        m->base.lock(&m->base, m->framebuffer, 
-                GRALLOC_USAGE_SW_WRITE_RARELY, 
-                0, 0, m->info.xres, m->info.yres,
-                &fb_vaddr);
+        const size_t bpp = m->info.bits_per_pixel >> 3;
+        // converted posts are rendered at 32 bpp
+        const size_t srcBpp = (m->flags & CONVERT_565) ? 4 : bpp;
+        int l = 0, t = 0;
+        int r = m->info.xres, b = m->info.yres;
+        if (ctx->updateRight > ctx->updateLeft) {
+            // everything outside the damage is already on screen
+            l = ctx->updateLeft;
+            t = ctx->updateTop;
+            r = ctx->updateRight;
+            b = ctx->updateBottom;
+            m->numPartialCopies++;
+        }
 
-        m->base.lock(&m->base, buffer, 
-                GRALLOC_USAGE_SW_READ_RARELY, 
-                0, 0, m->info.xres, m->info.yres,
-                &buffer_vaddr);
+        /*
+         * A full-screen copy from a regular buffer is worth avoiding when
+         * the frame is the one already on screen. Damage-limited copies
+         * are cheaper than hashing the whole frame.
+         *
+         * Every row is hashed: a skipped post may be the last one for a
+         * while, so a change that wasn't looked at could stay off screen
+         * until something else changes.
+         */
+        bool hashed = false;
+        if ((m->flags & SKIP_IDENTICAL) &&
+                !(hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) &&
+                l == 0 && t == 0 &&
+                r == int(m->info.xres) && b == int(m->info.yres)) {
+            const size_t bytes = m->info.xres * srcBpp;
+            const size_t stride = (bytes + 3) & ~3;
+            const int64_t start = now_ns();
+            const uint64_t hash = fb_hash_rows((void const*)hnd->base,
+                    stride, bytes, m->info.yres);
+            m->numHashedPosts++;
+            if (ctx->screenHashValid && hash == ctx->screenHash) {
+                m->hashTimeNs += now_ns() - start;
+                m->numSkippedPosts++;
+                ctx->updateLeft = ctx->updateRight = 0;
+                ctx->updateTop = ctx->updateBottom = 0;
+                m->info.reserved[0] = 0;
+                return 0;
+            }
+            ctx->screenHash = hash;
+            m->hashTimeNs += now_ns() - start;
+            hashed = true;
+        }
+        // the front buffer only matches the hash of a full copy
+        ctx->screenHashValid = hashed;
 
-        memcpy(fb_vaddr, buffer_vaddr, m->finfo.line_length * m->info.yres);
-        
-        m->base.unlock(&m->base, buffer); 
-        m->base.unlock(&m->base, m->framebuffer); 
+        int err = -EINVAL;
+        if ((m->flags & BLIT_COPY) &&
+                (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)) {
+            // both buffers live in framebuffer memory, let G2D do it
+            fb_surface_t src, dst;
+            dst.phys = m->finfo.smem_start;
+            dst.stride = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
+            dst.height = m->info.yres;
+            dst.bpp = m->info.bits_per_pixel;
+            src = dst;
+            src.phys += hnd->offset;
+            if (m->flags & BEAM_CHASE) {
+                // the blitter outruns the beam by far
+                fb_wait_vsync(m);
+            }
+            err = fb_blit_copy(m->g2dFd, &dst, l, t, &src, l, t, r - l, b - t);
+            if (err < 0) {
+                LOGW("G2D copy failed (%s), copying with the CPU",
+                        strerror(-err));
+                m->flags &= ~BLIT_COPY;
+            } else {
+                m->numBlits++;
+            }
+        }
+
+        if (err < 0) {
+            void* fb_vaddr;
+            void* buffer_vaddr;
+            
+            m->base.lock(&m->base, m->framebuffer, 
+                    GRALLOC_USAGE_SW_WRITE_RARELY, 
+                    0, 0, m->info.xres, m->info.yres,
+                    &fb_vaddr);
+
+            m->base.lock(&m->base, buffer, 
+                    GRALLOC_USAGE_SW_READ_RARELY, 
+                    0, 0, m->info.xres, m->info.yres,
+                    &buffer_vaddr);
+
+            // back buffers outside the framebuffer were allocated packed
+            const size_t dstStride = m->finfo.line_length;
+            const size_t srcStride =
+                    (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) ?
+                    dstStride : ((m->info.xres * srcBpp + 3) & ~3);
+            uint8_t* dst = (uint8_t*)fb_vaddr + t * dstStride + l * bpp;
+            uint8_t const* src =
+                    (uint8_t const*)buffer_vaddr + t * srcStride + l * srcBpp;
+            if (m->flags & CONVERT_565) {
+                fb_convert_565(ctx->workers, dst, dstStride, src, srcStride,
+                        l, t, r - l, b - t);
+            } else if (m->flags & BEAM_CHASE) {
+                fb_copy_chasing(ctx, m, dst, dstStride, src, srcStride,
+                        (r - l) * bpp, t, b - t);
+            } else {
+                fb_copy(ctx->workers, dst, dstStride, src, srcStride,
+                        (r - l) * bpp, b - t);
+            }
+            
+            m->base.unlock(&m->base, buffer); 
+            m->base.unlock(&m->base, m->framebuffer); 
+        }
+        m->numCopies++;
+
+        if ((m->flags & UPDATE_HINT) && m->info.reserved[0]) {
+            // tell a partial-refresh panel which region changed
+            m->info.activate = FB_ACTIVATE_VBL;
+            m->info.yoffset = 0;
+            ioctl(m->framebuffer->fd, FBIOPAN_DISPLAY, &m->info);
+        }
+    }
+
+    ctx->updateLeft = ctx->updateRight = 0;
+    ctx->updateTop = ctx->updateBottom = 0;
+    m->info.reserved[0] = 0;
+    return 0;
+}
+
+static int period_ns(private_module_t const* m)
+{
+    return m->fps > 0 ? int(1000000000.0f / m->fps) : 16666667;
+}
+
+static int duration_bucket(int64_t ns)
+{
+    int bucket = 0;
+    for (int64_t ms = ns / 1000000 ; ms && bucket < DURATION_BUCKETS-1 ;
+            ms >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static void fb_record_frame(fb_context_t* ctx, private_module_t const* m,
+        int64_t start, int64_t done, int path)
+{
+    fb_timing_t* t = &ctx->timing;
+    const int64_t duration = done - start;
+
+    pthread_mutex_lock(&t->lock);
+    fb_frame_t* f = &t->frames[t->numFrames % FRAME_HISTORY];
+    f->start = start;
+    f->done = done;
+    f->path = path;
+
+    t->durations[duration_bucket(duration)]++;
+    t->totalDuration += duration;
+    if (duration > t->maxDuration)
+        t->maxDuration = duration;
+
+    // present intervals are measured between completions
+    if (t->numFrames) {
+        const int64_t interval = done - t->lastDone;
+        if (interval >= IDLE_NS) {
+            t->numIdle++;
+        } else {
+            const int period = period_ns(m);
+            int vsyncs = int((interval + period / 2) / period);
+            if (vsyncs > 1)
+                t->missedVsyncs += vsyncs - 1;
+            if (vsyncs > INTERVAL_BUCKETS - 1)
+                vsyncs = INTERVAL_BUCKETS - 1;
+            t->intervals[vsyncs]++;
+            if (interval > t->maxInterval)
+                t->maxInterval = interval;
+        }
+    }
+    t->lastDone = done;
+    t->numFrames++;
+
+    // a skipped post leaves the screen as it was, there is nothing to latch
+    if (t->latchRunning && !t->latchExiting && path != POST_SKIP) {
+        t->latchPending = start;
+        pthread_cond_signal(&t->latchCond);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void* fb_latch_main(void* arg)
+{
+    fb_context_t* ctx = (fb_context_t*)arg;
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            ctx->device.common.module);
+    fb_timing_t* t = &ctx->timing;
+
+    pthread_mutex_lock(&t->lock);
+    while (!t->latchExiting) {
+        if (!t->latchPending) {
+            pthread_cond_wait(&t->latchCond, &t->lock);
+            continue;
+        }
+        const int64_t start = t->latchPending;
+        pthread_mutex_unlock(&t->lock);
+        uint32_t crtc = 0;
+        const int err = ioctl(m->framebuffer->fd, FBIO_WAITFORVSYNC, &crtc);
+        const int64_t latched = now_ns();
+        pthread_mutex_lock(&t->lock);
+        if (err == -1) {
+            LOGW("FBIO_WAITFORVSYNC failed (%s), not timing latches",
+                    strerror(errno));
+            t->latchExiting = true;
+            break;
+        }
+        const int64_t latency = latched - start;
+        t->latencies[duration_bucket(latency)]++;
+        t->totalLatency += latency;
+        if (latency > t->maxLatency)
+            t->maxLatency = latency;
+        t->numLatched++;
+        // anything posted since latches at the next vsync at the earliest
+        if (t->latchPending == start)
+            t->latchPending = 0;
     }
-    
+    t->latchPending = 0;
+    pthread_mutex_unlock(&t->lock);
     return 0;
 }
 
+static void fb_latch_start(fb_context_t* ctx)
+{
+    fb_timing_t* t = &ctx->timing;
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.gralloc.latch_timing", value, "1");
+    if (!atoi(value))
+        return;
+    pthread_cond_init(&t->latchCond, 0);
+    t->latchRunning = true;
+    if (pthread_create(&t->latchThread, 0, fb_latch_main, ctx)) {
+        t->latchRunning = false;
+        pthread_cond_destroy(&t->latchCond);
+    }
+}
+
+static void fb_latch_stop(fb_context_t* ctx)
+{
+    fb_timing_t* t = &ctx->timing;
+    if (!t->latchRunning)
+        return;
+    pthread_mutex_lock(&t->lock);
+    t->latchExiting = true;
+    pthread_cond_signal(&t->latchCond);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->latchThread, 0);
+    pthread_cond_destroy(&t->latchCond);
+    t->latchRunning = false;
+}
+
 /*****************************************************************************/
 
+/*
+ * Mode timings. A frame is vtotal lines of htotal pixels each, sync
+ * pulses and porches included, and everything below is derived from
+ * those two, so the refresh rate, line time and idle margin agree.
+ */
+static uint32_t fb_htotal(struct fb_var_screeninfo const& info)
+{
+    return info.left_margin + info.right_margin + info.hsync_len + info.xres;
+}
+
+static uint32_t fb_vtotal(struct fb_var_screeninfo const& info)
+{
+    return info.upper_margin + info.lower_margin + info.vsync_len + info.yres;
+}
+
+/* refresh rate in mHz, 60 Hz when the driver doesn't say */
+static int fb_refresh_rate(struct fb_var_screeninfo const& info)
+{
+    uint64_t  refreshQuotient =
+    (
+            uint64_t( fb_vtotal(info) ) * fb_htotal(info) * info.pixclock
+    );
+
+    /* Beware, info.pixclock might be 0 under emulation, so avoid a
+     * division-by-0 here (SIGFPE on ARM) */
+    int refreshRate = refreshQuotient > 0 ? (int)(1000000000000000LLU / refreshQuotient) : 0;
+
+    if (refreshRate == 0) {
+        // bleagh, bad info from the driver
+        refreshRate = 60*1000;  // 60 Hz
+    }
+    return refreshRate;
+}
+
+/* time to scan out one line, blanking included */
+static uint32_t fb_line_time_ns(struct fb_var_screeninfo const& info)
+{
+    return uint32_t(1000000000000LL / fb_refresh_rate(info) / fb_vtotal(info));
+}
+
+/*****************************************************************************/
+
+static int fb_set_refresh_locked(fb_context_t* ctx, private_module_t* m,
+        bool idle)
+{
+    fb_idle_t* s = &ctx->idle;
+    struct fb_var_screeninfo info = m->info;
+    info.lower_margin = idle ? s->idleMargin : s->activeMargin;
+    info.activate = FB_ACTIVATE_NOW;
+    if (ioctl(m->framebuffer->fd, FBIOPUT_VSCREENINFO, &info) == -1) {
+        int err = -errno;
+        if (idle) {
+            // don't try to idle again
+            LOGW("couldn't change the refresh rate (%s), staying at %.2f Hz",
+                    strerror(-err), m->fps);
+            s->timeout = 0;
+        } else if (s->failedRestores++ == 0) {
+            // stuck at the idle rate, the next post tries again
+            LOGW("couldn't restore the refresh rate (%s), staying at "
+                    "%.2f Hz for now", strerror(-err), s->idleFps);
+        }
+        return err;
+    }
+    m->info.lower_margin = info.lower_margin;
+    if (!idle && s->failedRestores) {
+        LOGI("refresh rate restored after %u failed attempts",
+                s->failedRestores);
+        s->failedRestores = 0;
+    }
+
+    const int64_t now = now_ns();
+    const int64_t spent = now - s->since;
+    if (idle)
+        s->timeActive += spent;
+    else
+        s->timeIdle += spent;
+    LOGI("refresh %.2f -> %.2f Hz after %.1f s",
+            idle ? m->fps : s->idleFps, idle ? s->idleFps : m->fps,
+            spent / 1e9);
+    s->since = now;
+    s->idle = idle;
+    s->numSwitches++;
+    return 0;
+}
+
+static void* fb_idle_main(void* arg)
+{
+    fb_context_t* ctx = (fb_context_t*)arg;
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            ctx->device.common.module);
+    fb_idle_t* s = &ctx->idle;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->exiting) {
+        if (s->idle || !s->timeout) {
+            // the next post wakes us up
+            pthread_cond_wait(&s->cond, &s->lock);
+            continue;
+        }
+        const int64_t left = s->lastPost + s->timeout - now_ns();
+        if (left > 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            int64_t ns = ts.tv_nsec + left;
+            ts.tv_sec += ns / 1000000000LL;
+            ts.tv_nsec = ns % 1000000000LL;
+            pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+            continue;
+        }
+        fb_set_refresh_locked(ctx, m, true);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+/*
+ * debug.gralloc.idle_timeout is in ms, debug.gralloc.idle_fps the rate
+ * to drop to. Only starts when the driver gave real timings.
+ */
+static void fb_idle_start(fb_context_t* ctx, private_module_t* m)
+{
+    fb_idle_t* s = &ctx->idle;
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.gralloc.idle_timeout", value, "0");
+    const int timeout = atoi(value);
+    property_get("debug.gralloc.idle_fps", value, "40");
+    const float idleFps = atof(value);
+    if (timeout <= 0)
+        return;
+
+    const fb_var_screeninfo& info = m->info;
+    const uint32_t lines = fb_vtotal(info);
+    if (!info.pixclock || idleFps <= 0 || idleFps >= m->fps) {
+        LOGW("can't lower the refresh rate from %.2f to %.2f Hz",
+                m->fps, idleFps);
+        return;
+    }
+
+    s->activeMargin = info.lower_margin;
+    s->idleMargin = info.lower_margin +
+            uint32_t(lines * (m->fps / idleFps)) - lines;
+    s->idleFps = idleFps;
+    s->timeout = timeout * 1000000LL;
+    s->lastPost = s->since = now_ns();
+    pthread_mutex_init(&s->lock, 0);
+    pthread_cond_init(&s->cond, 0);
+    if (pthread_create(&s->thread, 0, fb_idle_main, ctx)) {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+        return;
+    }
+    s->running = true;
+    LOGI("dropping to %.2f Hz (lower_margin %u -> %u) after %d ms idle",
+            idleFps, s->activeMargin, s->idleMargin, timeout);
+}
+
+static void fb_idle_stop(fb_context_t* ctx)
+{
+    fb_idle_t* s = &ctx->idle;
+    if (!s->running)
+        return;
+    pthread_mutex_lock(&s->lock);
+    s->exiting = true;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, 0);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    s->running = false;
+}
+
+/*
+ * Buffer ages. Each framebuffer numbers its successful posts, and every
+ * handle remembers the number of the post that last presented it. Flip
+ * slots and the regular buffers handed out instead of them are treated
+ * the same: whatever the post did with them, their own contents are
+ * still the frame they were posted with.
+ */
+static void fb_mark_posted(uint32_t* seq, buffer_handle_t buffer, int fb)
+{
+    private_handle_t* hnd = const_cast<private_handle_t*>(
+            reinterpret_cast<private_handle_t const*>(buffer));
+    // 0 means never posted, skip it when the count wraps
+    if (++*seq == 0)
+        ++*seq;
+    hnd->lastPost = *seq;
+    hnd->lastPostFb = fb;
+}
+
+int getBufferAge(struct private_module_t const* module,
+        private_handle_t const* hnd)
+{
+    // the sequence numbers only mean something in the posting process
+    if (hnd->pid != getpid() || hnd->lastPost == 0)
+        return 0;
+    const uint32_t seq = hnd->lastPostFb ? module->fb1.postSeq :
+            module->postSeq;
+    const uint32_t age = seq - uint32_t(hnd->lastPost) + 1;
+    return age > INT_MAX ? 0 : int(age);
+}
+
+static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
+{
+    fb_context_t* ctx = (fb_context_t*)dev;
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            dev->common.module);
+    fb_idle_t* idle = &ctx->idle;
+
+    // the counters tell which way the post went
+    const uint32_t pans = m->numPanFlips;
+    const uint32_t puts = m->numPutFlips;
+    const uint32_t blits = m->numBlits;
+    const uint32_t skips = m->numSkippedPosts;
+
+    const int64_t start = now_ns();
+    if (idle->running) {
+        pthread_mutex_lock(&idle->lock);
+        if (idle->idle) {
+            // back to full speed before this frame goes out
+            if (fb_set_refresh_locked(ctx, m, false) == 0) {
+                const int64_t restore = now_ns() - start;
+                if (restore > idle->maxRestore)
+                    idle->maxRestore = restore;
+            }
+            pthread_cond_signal(&idle->cond);
+        }
+    }
+    int err = fb_post_buffer(dev, buffer);
+    const int64_t done = now_ns();
+    if (idle->running) {
+        idle->lastPost = done;
+        pthread_mutex_unlock(&idle->lock);
+    }
+    if (err == 0) {
+        fb_mark_posted(&m->postSeq, buffer, 0);
+        int path = POST_COPY;
+        if (m->numPanFlips != pans)             path = POST_PAN;
+        else if (m->numPutFlips != puts)        path = POST_PUT;
+        else if (m->numBlits != blits)          path = POST_BLIT;
+        else if (m->numSkippedPosts != skips)   path = POST_SKIP;
+        fb_record_frame(ctx, m, start, done, path);
+    }
+    return err;
+}
+
+static void fb_dump(struct framebuffer_device_t* dev, char *buff, int buff_len)
+{
+    static const char* const paths[] = { "pan", "put", "copy", "g2d", "skip" };
+    fb_context_t* ctx = (fb_context_t*)dev;
+    fb_timing_t* t = &ctx->timing;
+    private_module_t const* m = reinterpret_cast<private_module_t const*>(
+            dev->common.module);
+    if (buff_len <= 0)
+        return;
+    buff[0] = 0;
+
+    int n = 0;
+#define DUMP(...) \
+    do { \
+        if (n < buff_len) \
+            n += snprintf(buff + n, buff_len - n, __VA_ARGS__); \
+    } while (0)
+
+    pthread_mutex_lock(&t->lock);
+    const int period = period_ns(m);
+    DUMP("  gralloc fb: %ux%u %dbpp @ %.2f Hz (%.2f ms), %s\n",
+            m->info.xres, m->info.yres, m->info.bits_per_pixel,
+            m->fps, period / 1e6,
+            (m->flags & PAGE_FLIP) ? "page flipping" :
+                    (m->flags & CONVERT_565) ? "dithering to 565" : "copying");
+    DUMP("    posts: %u (pan %u, put %u, copy %u [partial %u, g2d %u], "
+            "skipped %u of %u hashed)\n",
+            t->numFrames, m->numPanFlips, m->numPutFlips, m->numCopies,
+            m->numPartialCopies, m->numBlits,
+            m->numSkippedPosts, m->numHashedPosts);
+    if (m->flags & BEAM_CHASE)
+        DUMP("    late beam chases: %u\n", m->numLateChases);
+    if (n < buff_len)
+        n += m->lock.dump(buff + n, buff_len - n, "module lock");
+    if (n < buff_len)
+        n += dumpMapperLocks(buff + n, buff_len - n);
+    if (m->rotation) {
+        DUMP("    rotated by %d: %u posts, avg %.2f ms\n", m->rotation,
+                m->numRotations, m->numRotations ?
+                m->rotateTimeNs / (1e6 * m->numRotations) : 0.0);
+    }
+    DUMP("    missed vsyncs: %u, idle gaps: %u, longest interval: %.2f ms\n",
+            t->missedVsyncs, t->numIdle, t->maxInterval / 1e6);
+    DUMP("    interval (vsyncs):  <1:%u 1:%u 2:%u 3:%u 4:%u 5+:%u\n",
+            t->intervals[0], t->intervals[1], t->intervals[2],
+            t->intervals[3], t->intervals[4], t->intervals[5]);
+    DUMP("    post time (ms):     <1:%u <2:%u <4:%u <8:%u <16:%u <32:%u "
+            "32+:%u\n",
+            t->durations[0], t->durations[1], t->durations[2],
+            t->durations[3], t->durations[4], t->durations[5],
+            t->durations[6]);
+    DUMP("    post time: avg %.2f ms, max %.2f ms\n",
+            t->numFrames ? t->totalDuration / (1e6 * t->numFrames) : 0.0,
+            t->maxDuration / 1e6);
+    if (t->numLatched) {
+        DUMP("    post to latch (ms): <1:%u <2:%u <4:%u <8:%u <16:%u <32:%u "
+                "32+:%u\n",
+                t->latencies[0], t->latencies[1], t->latencies[2],
+                t->latencies[3], t->latencies[4], t->latencies[5],
+                t->latencies[6]);
+        DUMP("    post to latch: avg %.2f ms, max %.2f ms over %u posts\n",
+                t->totalLatency / (1e6 * t->numLatched),
+                t->maxLatency / 1e6, t->numLatched);
+    }
+    if (ctx->idle.running) {
+        fb_idle_t* s = &ctx->idle;
+        pthread_mutex_lock(&s->lock);
+        const int64_t spent = now_ns() - s->since;
+        DUMP("    refresh: %.1f s at %.2f Hz, %.1f s at %.2f Hz (now %s), "
+                "%u switches, slowest restore %.2f ms\n",
+                (s->timeActive + (s->idle ? 0 : spent)) / 1e9, m->fps,
+                (s->timeIdle + (s->idle ? spent : 0)) / 1e9, s->idleFps,
+                s->idle ? "idle" : "active",
+                s->numSwitches, s->maxRestore / 1e6);
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    // oldest first, intervals relative to the post before
+    uint32_t count = t->numFrames < FRAME_DUMP ? t->numFrames : FRAME_DUMP;
+    if (count)
+        DUMP("    last %u posts (interval / post time, ms):\n", count);
+    for (uint32_t i = t->numFrames - count ; i < t->numFrames ; i++) {
+        fb_frame_t const* f = &t->frames[i % FRAME_HISTORY];
+        double interval = 0;
+        if (i)
+            interval = (f->done - t->frames[(i-1) % FRAME_HISTORY].done) / 1e6;
+        DUMP("      %8.2f %6.2f %s\n", interval,
+                (f->done - f->start) / 1e6, paths[f->path]);
+    }
+    pthread_mutex_unlock(&t->lock);
+#undef DUMP
+}
+
+/*****************************************************************************/
+
+/*
+ * Clear screen 'index' of the framebuffer unless it already was. Only the
+ * visible screen is cleared when mapping, the back buffers are cleared
+ * when first handed out, with G2D if possible.
+ */
+void clearFrameBufferLocked(struct private_module_t* module, uint32_t index)
+{
+    if (index >= module->numBuffers || (module->clearedMask & (1LU<<index)))
+        return;
+
+    const int64_t start = now_ns();
+    const size_t screenSize = module->finfo.line_length * module->info.yres;
+    fb_surface_t dst;
+    dst.phys = module->finfo.smem_start + index * screenSize;
+    dst.stride = module->finfo.line_length / (module->info.bits_per_pixel >> 3);
+    dst.height = module->info.yres;
+    dst.bpp = module->info.bits_per_pixel;
+    const bool blitted = fb_blit_fill(module->g2dFd, &dst,
+            0, 0, module->info.xres, module->info.yres, 0) == 0;
+    if (!blitted) {
+        memset((void*)(module->framebuffer->base + index * screenSize), 0,
+                screenSize);
+    }
+    module->clearedMask |= 1LU<<index;
+    LOGD("cleared screen %u with %s in %.2f ms", index,
+            blitted ? "G2D" : "memset", (now_ns() - start) / 1e6);
+}
+
 int mapFrameBufferLocked(struct private_module_t* module)
 {
     // already initialized...
     if (module->framebuffer) {
         return 0;
     }
+
+    // startup steps, logged once the first screen is clear
+    int64_t start = now_ns();
+    int64_t tOpen, tMode, tPan, tG2d, tMap, tClear;
         
     char const * const device_template[] = {
             "/dev/graphics/fb%u",
@@ -155,6 +1009,7 @@ int mapFrameBufferLocked(struct private_module_t* module)
     }
     if (fd < 0)
         return -errno;
+    tOpen = now_ns();
 
     struct fb_fix_screeninfo finfo;
     if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1)
@@ -170,21 +1025,80 @@ int mapFrameBufferLocked(struct private_module_t* module)
     info.xoffset = 0;
     info.yoffset = 0;
     info.activate = FB_ACTIVATE_NOW;
+    // the driver's own depth, to go back to if it won't do 16 bpp
+    const struct fb_var_screeninfo orig = info;
+
+    /*
+     * debug.gralloc.fb_bpp=16 halves what the display controller fetches.
+     * With debug.gralloc.fb_dither=1 the compositor keeps rendering at
+     * 32 bpp and fb_post dithers every frame down to 565 instead, which
+     * rules out page flipping.
+     */
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.gralloc.fb_bpp", value, "0");
+    const int bpp = atoi(value);
+    property_get("debug.gralloc.fb_dither", value, "0");
+    bool convert = (bpp == 16) && atoi(value);
+
+    /*
+     * debug.gralloc.rotation=90|180|270 is for panels mounted sideways or
+     * upside down: the compositor renders the rotated screen and fb_post
+     * turns it around, with G2D if it can. Also rules out page flipping.
+     */
+    property_get("debug.gralloc.rotation", value, "0");
+    int rotation = atoi(value);
+    if (rotation != 90 && rotation != 180 && rotation != 270) {
+        rotation = 0;
+    }
+    if (rotation && convert) {
+        LOGW("can't dither rotated posts, scanning out 565 directly");
+        convert = false;
+    }
+    bool single = convert || rotation;
+    if (bpp == 16) {
+        info.bits_per_pixel = 16;
+        info.red.offset     = 11;
+        info.red.length     = 5;
+        info.green.offset   = 5;
+        info.green.length   = 6;
+        info.blue.offset    = 0;
+        info.blue.length    = 5;
+        info.transp.offset  = 0;
+        info.transp.length  = 0;
+    }
 
     /*
      * Request NUM_BUFFERS screens (at lest 2 for page flipping)
      */
-    info.yres_virtual = info.yres * NUM_BUFFERS;
+    info.yres_virtual = info.yres * (single ? 1 : NUM_BUFFERS);
 
 
-    uint32_t flags = PAGE_FLIP;
-    if (ioctl(fd, FBIOPUT_VSCREENINFO, &info) == -1) {
+    uint32_t flags = single ? 0 : PAGE_FLIP;
+    int put = ioctl(fd, FBIOPUT_VSCREENINFO, &info);
+    if (bpp == 16) {
+        // the driver may refuse 565 or quietly keep another depth
+        struct fb_var_screeninfo actual;
+        if (put == -1 || ioctl(fd, FBIOGET_VSCREENINFO, &actual) == -1 ||
+                actual.bits_per_pixel != 16) {
+            LOGW("16 bpp scanout not supported, using %d bpp",
+                    orig.bits_per_pixel);
+            // back to the driver's bitfields, and to flipping if only
+            // dithering ruled it out
+            info = orig;
+            convert = false;
+            single = rotation != 0;
+            flags = single ? 0 : PAGE_FLIP;
+            info.yres_virtual = info.yres * (single ? 1 : NUM_BUFFERS);
+            put = ioctl(fd, FBIOPUT_VSCREENINFO, &info);
+        }
+    }
+    if (put == -1) {
         info.yres_virtual = info.yres;
         flags &= ~PAGE_FLIP;
         LOGW("FBIOPUT_VSCREENINFO failed, page flipping not supported");
     }
 
-    if (info.yres_virtual < info.yres * 2) {
+    if ((flags & PAGE_FLIP) && info.yres_virtual < info.yres * 2) {
         // we need at least 2 for page-flipping
         info.yres_virtual = info.yres;
         flags &= ~PAGE_FLIP;
@@ -195,21 +1109,27 @@ int mapFrameBufferLocked(struct private_module_t* module)
     if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1)
         return -errno;
 
-    uint64_t  refreshQuotient =
-    (
-            uint64_t( info.upper_margin + info.lower_margin + info.yres )
-            * ( info.left_margin  + info.right_margin + info.xres )
-            * info.pixclock
-    );
-
-    /* Beware, info.pixclock might be 0 under emulation, so avoid a
-     * division-by-0 here (SIGFPE on ARM) */
-    int refreshRate = refreshQuotient > 0 ? (int)(1000000000000000LLU / refreshQuotient) : 0;
+    if (convert) {
+        flags |= CONVERT_565;
+    }
+    tMode = now_ns();
 
-    if (refreshRate == 0) {
-        // bleagh, bad info from the driver
-        refreshRate = 60*1000;  // 60 Hz
+    if (flags & PAGE_FLIP) {
+        /*
+         * Check once whether the driver can flip by panning alone, so
+         * fb_post doesn't push the whole mode through FBIOPUT_VSCREENINFO
+         * on every frame.
+         */
+        if (ioctl(fd, FBIOPAN_DISPLAY, &info) == 0) {
+            flags |= PAN_DISPLAY;
+        } else {
+            LOGW("FBIOPAN_DISPLAY not supported (%s), flipping with "
+                    "FBIOPUT_VSCREENINFO", strerror(errno));
+        }
     }
+    tPan = now_ns();
+
+    int refreshRate = fb_refresh_rate(info);
 
     if (int(info.width) <= 0 || int(info.height) <= 0) {
         // the driver doesn't return that information
@@ -218,6 +1138,8 @@ int mapFrameBufferLocked(struct private_module_t* module)
         info.height = ((info.yres * 25.4f)/160.0f + 0.5f);
     }
 
+    uint32_t lineTimeNs = fb_line_time_ns(info);
+
     float xdpi = (info.xres * 25.4f) / info.width;
     float ydpi = (info.yres * 25.4f) / info.height;
     float fps  = refreshRate / 1000.0f;
@@ -231,7 +1153,11 @@ int mapFrameBufferLocked(struct private_module_t* module)
             "bpp          = %d\n"
             "r            = %2u:%u\n"
             "g            = %2u:%u\n"
-            "b            = %2u:%u\n",
+            "b            = %2u:%u\n"
+            "width        = %d mm (%f dpi)\n"
+            "height       = %d mm (%f dpi)\n"
+            "refresh rate = %.2f Hz\n"
+            "flip method  = %s\n",
             fd,
             finfo.id,
             info.xres,
@@ -241,15 +1167,14 @@ int mapFrameBufferLocked(struct private_module_t* module)
             info.bits_per_pixel,
             info.red.offset, info.red.length,
             info.green.offset, info.green.length,
-            info.blue.offset, info.blue.length
-    );
-
-    LOGI(   "width        = %d mm (%f dpi)\n"
-            "height       = %d mm (%f dpi)\n"
-            "refresh rate = %.2f Hz\n",
+            info.blue.offset, info.blue.length,
             info.width,  xdpi,
             info.height, ydpi,
-            fps
+            fps,
+            (flags & PAN_DISPLAY) ? "pan" :
+                    (flags & PAGE_FLIP) ? "put_vscreeninfo" :
+                    (flags & CONVERT_565) ? "dithered copy" :
+                    rotation ? "rotated copy" : "copy"
     );
 
 
@@ -259,6 +1184,29 @@ int mapFrameBufferLocked(struct private_module_t* module)
     if (finfo.smem_len <= 0)
         return -errno;
 
+    /*
+     * If we can't flip but the framebuffer memory has room for more than
+     * one screen, hand out the extra screens as back buffers: fb_post can
+     * then copy them to the front with G2D instead of the CPU.
+     */
+    uint32_t numBuffers = info.yres_virtual / info.yres;
+    const size_t screenSize = finfo.line_length * info.yres;
+    // also used to clear the back buffers
+    const int g2d = fb_blit_open();
+    if (!(flags & (PAGE_FLIP | CONVERT_565)) &&
+            finfo.smem_len >= screenSize * 2) {
+        if (g2d >= 0) {
+            numBuffers = finfo.smem_len / screenSize;
+            if (numBuffers > NUM_BUFFERS + 1)
+                numBuffers = NUM_BUFFERS + 1;
+            flags |= BLIT_COPY;
+        } else {
+            LOGW("couldn't open G2D (%s), copying with the CPU",
+                    strerror(-g2d));
+        }
+    }
+    tG2d = now_ns();
+
 
     module->flags = flags;
     module->info = info;
@@ -266,17 +1214,22 @@ int mapFrameBufferLocked(struct private_module_t* module)
     module->xdpi = xdpi;
     module->ydpi = ydpi;
     module->fps = fps;
+    module->lineTimeNs = lineTimeNs;
+    module->rotation = rotation;
+    module->g2dFd = g2d < 0 ? -1 : g2d;
+    module->clearedMask = 0;
 
     /*
      * map the framebuffer
      */
 
     int err;
-    size_t fbSize = roundUpToPageSize(finfo.line_length * info.yres_virtual);
+    size_t fbSize = roundUpToPageSize(screenSize * numBuffers);
     module->framebuffer = new private_handle_t(dup(fd), fbSize, 0);
 
-    module->numBuffers = info.yres_virtual / info.yres;
-    module->bufferMask = 0;
+    module->numBuffers = numBuffers;
+    // when blitting, the first screen is the front buffer and never handed out
+    module->bufferMask = (flags & BLIT_COPY) ? 1 : 0;
 
     void* vaddr = mmap(0, fbSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
     if (vaddr == MAP_FAILED) {
@@ -284,15 +1237,462 @@ int mapFrameBufferLocked(struct private_module_t* module)
         return -errno;
     }
     module->framebuffer->base = intptr_t(vaddr);
-    memset(vaddr, 0, fbSize);
+    tMap = now_ns();
+
+    // the rest is cleared on first use, see clearFrameBufferLocked
+    clearFrameBufferLocked(module, 0);
+    tClear = now_ns();
+
+    LOGI("framebuffer ready in %.2f ms: open %.2f, mode %.2f, pan %.2f, "
+            "g2d %.2f, mmap %.2f, clear %.2f",
+            (tClear - start) / 1e6, (tOpen - start) / 1e6,
+            (tMode - tOpen) / 1e6, (tPan - tMode) / 1e6,
+            (tG2d - tPan) / 1e6, (tMap - tG2d) / 1e6,
+            (tClear - tMap) / 1e6);
     return 0;
 }
 
 static int mapFrameBuffer(struct private_module_t* module)
 {
-    pthread_mutex_lock(&module->lock);
+    module->lock.lock();
     int err = mapFrameBufferLocked(module);
-    pthread_mutex_unlock(&module->lock);
+    module->lock.unlock();
+    return err;
+}
+
+/*****************************************************************************/
+
+void clearSecondaryFrameBufferLocked(private_module_t* module, uint32_t index)
+{
+    private_fb_t* fb = &module->fb1;
+    if (index >= fb->numBuffers || (fb->clearedMask & (1LU<<index)))
+        return;
+    const size_t screenSize = fb->finfo.line_length * fb->info.yres;
+    memset((void*)(fb->framebuffer->base + index * screenSize), 0, screenSize);
+    fb->clearedMask |= 1LU<<index;
+}
+
+static int fb1_map_locked(private_module_t* module, int fd,
+        struct fb_var_screeninfo info, struct fb_fix_screeninfo const& finfo,
+        uint32_t flags);
+static int fb1_revalidate_locked(private_module_t* module);
+
+int mapSecondaryFrameBufferLocked(private_module_t* module)
+{
+    private_fb_t* fb = &module->fb1;
+    if (fb->framebuffer)
+        return fb1_revalidate_locked(module);
+
+    char const * const device_template[] = {
+            "/dev/graphics/fb%u",
+            "/dev/fb%u",
+            0 };
+
+    int fd = -1;
+    char name[64];
+    for (int i=0 ; fd == -1 && device_template[i] ; i++) {
+        snprintf(name, 64, device_template[i], 1);
+        fd = open(name, O_RDWR, 0);
+    }
+    if (fd < 0)
+        return -errno;
+
+    struct fb_fix_screeninfo finfo;
+    struct fb_var_screeninfo info;
+    if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+
+    if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+
+    /*
+     * fb1's mode belongs to the display HAL, which caches it. Flip when
+     * it gave fb1 more than one screen, copy into it otherwise.
+     */
+    uint32_t flags = 0;
+    if (info.yres_virtual >= info.yres * 2 &&
+            ioctl(fd, FBIOPAN_DISPLAY, &info) == 0)
+        flags |= PAGE_FLIP | PAN_DISPLAY;
+
+    int err = fb1_map_locked(module, fd, info, finfo, flags);
+    if (err < 0)
+        close(fd);
+    return err;
+}
+
+/*
+ * The display HAL requests fb1 again whenever the TV or HDMI mode
+ * changes, which can move and resize it. That is looked for when fb1 is
+ * opened or allocated from, when a pan fails and before a copy, but not
+ * on flips that go through: the device's size is fixed at open, so its
+ * clients have to reopen it after a mode change anyway.
+ *
+ * When the screens kept their size, the new memory is mapped over the
+ * old mapping and the slots still out keep working. When they didn't,
+ * those slots are the wrong size: their posts fail until they were all
+ * freed, then fb1 is mapped afresh.
+ */
+static int fb1_revalidate_locked(private_module_t* module)
+{
+    private_fb_t* fb = &module->fb1;
+    const int fd = fb->framebuffer->fd;
+    struct fb_fix_screeninfo finfo;
+    struct fb_var_screeninfo info;
+    if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1 ||
+            ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1)
+        return -errno;
+
+    const bool sameScreens = info.yres &&
+            finfo.line_length == fb->finfo.line_length &&
+            info.xres == fb->info.xres && info.yres == fb->info.yres &&
+            info.bits_per_pixel == fb->info.bits_per_pixel &&
+            info.yres_virtual / info.yres >= fb->numBuffers;
+    if (sameScreens && finfo.smem_start == fb->finfo.smem_start &&
+            finfo.smem_len == fb->finfo.smem_len) {
+        fb->stale = false;
+        return 0;
+    }
+
+    if (fb->bufferMask) {
+        if (sameScreens && finfo.smem_len >= size_t(fb->framebuffer->size)) {
+            void* vaddr = mmap((void*)fb->framebuffer->base,
+                    fb->framebuffer->size, PROT_READ|PROT_WRITE,
+                    MAP_SHARED|MAP_FIXED, fd, 0);
+            if (vaddr == MAP_FAILED) {
+                int err = -errno;
+                LOGE("fb1 moved and can't be mapped again (%s)",
+                        strerror(-err));
+                return err;
+            }
+            fb->info = info;
+            fb->finfo = finfo;
+            fb->clearedMask = 0;
+            fb->stale = false;
+            LOGI("fb1 moved, mapped again in place");
+            return 0;
+        }
+        if (!fb->stale) {
+            LOGE("fb1 changed to %ux%u %d bpp, its %ux%u slots can't be "
+                    "posted anymore: free them and reopen fb1",
+                    info.xres, info.yres, info.bits_per_pixel,
+                    fb->info.xres, fb->info.yres);
+            fb->stale = true;
+        }
+        return -ESTALE;
+    }
+
+    munmap((void*)fb->framebuffer->base, fb->framebuffer->size);
+    delete fb->framebuffer;
+    fb->framebuffer = 0;
+
+    uint32_t flags = 0;
+    if (info.yres_virtual >= info.yres * 2)
+        flags |= PAGE_FLIP | PAN_DISPLAY;
+    int err = fb1_map_locked(module, fd, info, finfo, flags);
+    if (err < 0) {
+        // the next call starts over from opening fb1
+        close(fd);
+    }
+    return err;
+}
+
+static int fb1_map_locked(private_module_t* module, int fd,
+        struct fb_var_screeninfo info, struct fb_fix_screeninfo const& finfo,
+        uint32_t flags)
+{
+    private_fb_t* fb = &module->fb1;
+    if (int(info.width) <= 0 || int(info.height) <= 0) {
+        // default to 160 dpi
+        info.width  = ((info.xres * 25.4f)/160.0f + 0.5f);
+        info.height = ((info.yres * 25.4f)/160.0f + 0.5f);
+    }
+
+    const size_t screenSize = finfo.line_length * info.yres;
+    const uint32_t numBuffers = (flags & PAGE_FLIP) ?
+            info.yres_virtual / info.yres : 1;
+    const size_t fbSize = roundUpToPageSize(screenSize * numBuffers);
+    if (!screenSize || finfo.smem_len < screenSize * numBuffers) {
+        return -EINVAL;
+    }
+    void* vaddr = mmap(0, fbSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (vaddr == MAP_FAILED) {
+        int err = -errno;
+        LOGE("Error mapping fb1 (%s)", strerror(-err));
+        return err;
+    }
+
+    fb->framebuffer = new private_handle_t(fd, fbSize, 0);
+    fb->framebuffer->base = intptr_t(vaddr);
+    fb->flags = flags;
+    fb->numBuffers = numBuffers;
+    fb->bufferMask = 0;
+    fb->clearedMask = 0;
+    fb->currentBuffer = 0;
+    fb->stale = false;
+    fb->info = info;
+    fb->finfo = finfo;
+    fb->xdpi = (info.xres * 25.4f) / info.width;
+    fb->ydpi = (info.yres * 25.4f) / info.height;
+    fb->fps = fb_refresh_rate(info) / 1000.0f;
+    clearSecondaryFrameBufferLocked(module, 0);
+
+    LOGI("fb1: %ux%u, %d bpp, %.2f Hz, %u buffer(s), flip method %s",
+            info.xres, info.yres, info.bits_per_pixel, fb->fps, numBuffers,
+            (flags & PAN_DISPLAY) ? "pan" :
+                    (flags & PAGE_FLIP) ? "put_vscreeninfo" : "copy");
+    return 0;
+}
+
+static int fb1_post_buffer(struct framebuffer_device_t* dev,
+        buffer_handle_t buffer)
+{
+    if (private_handle_t::validate(buffer) < 0)
+        return -EINVAL;
+
+    private_handle_t const* hnd = reinterpret_cast<private_handle_t const*>(buffer);
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            dev->common.module);
+    private_fb_t* fb = &m->fb1;
+
+    if (!fb->framebuffer) {
+        int err = mapSecondaryFrameBufferLocked(m);
+        if (err < 0)
+            return err;
+    }
+    if (fb->stale)
+        return -ESTALE;
+
+    const bool slot = (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) &&
+            (hnd->flags & private_handle_t::PRIV_FLAGS_FB1);
+    if (slot && (fb->flags & PAGE_FLIP)) {
+        // only panned, a failed pan is the display HAL having moved fb1
+        for (int tries=0 ; ; tries++) {
+            fb->info.activate = FB_ACTIVATE_VBL;
+            fb->info.yoffset = hnd->offset / fb->finfo.line_length;
+            if (ioctl(fb->framebuffer->fd, FBIOPAN_DISPLAY, &fb->info) == 0)
+                break;
+            int err = -errno;
+            if (tries) {
+                LOGE("fb1: FBIOPAN_DISPLAY failed (%s)", strerror(-err));
+                return err;
+            }
+            err = fb1_revalidate_locked(m);
+            if (err < 0)
+                return err;
+        }
+        fb->numFlips++;
+        fb->currentBuffer = buffer;
+        return 0;
+    }
+
+    // a copy writes through the mapping, two ioctls are nothing next to it
+    int err = fb1_revalidate_locked(m);
+    if (err < 0)
+        return err;
+
+    // regular buffers were allocated packed, at fb1's size
+    const size_t bpp = fb->info.bits_per_pixel >> 3;
+    const size_t bytes = fb->info.xres * bpp;
+    const size_t srcStride = slot ? fb->finfo.line_length : ((bytes + 3) & ~3);
+    if ((hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) && !slot)
+        return -EINVAL;
+    if (size_t(hnd->size) < srcStride * fb->info.yres)
+        return -EINVAL;
+    fb_copy_rows((void*)fb->framebuffer->base, fb->finfo.line_length,
+            (void const*)hnd->base, srcStride, bytes, fb->info.yres);
+    fb->numCopies++;
+    return 0;
+}
+
+static int fb1_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
+{
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            dev->common.module);
+    // fb1 may be remapped, and its slots are allocated under the lock
+    m->lock.lock();
+    int err = fb1_post_buffer(dev, buffer);
+    if (err == 0) {
+        fb_mark_posted(&m->fb1.postSeq, buffer, 1);
+    }
+    m->lock.unlock();
+    return err;
+}
+
+static int fb1_close(struct hw_device_t *dev)
+{
+    free(dev);
+    return 0;
+}
+
+static int fb1_device_open(hw_module_t const* module, hw_device_t** device)
+{
+    private_module_t* m = (private_module_t*)module;
+    m->lock.lock();
+    int status = mapSecondaryFrameBufferLocked(m);
+    m->lock.unlock();
+    if (status < 0)
+        return status;
+
+    private_fb_t const* fb = &m->fb1;
+    framebuffer_device_t* dev =
+            (framebuffer_device_t*)malloc(sizeof(framebuffer_device_t));
+    if (!dev)
+        return -ENOMEM;
+    memset(dev, 0, sizeof(*dev));
+    dev->common.tag = HARDWARE_DEVICE_TAG;
+    dev->common.version = 0;
+    dev->common.module = const_cast<hw_module_t*>(module);
+    dev->common.close = fb1_close;
+    dev->setSwapInterval = fb_setSwapInterval;
+    dev->post = fb1_post;
+
+    const int bpp = fb->info.bits_per_pixel >> 3;
+    const_cast<uint32_t&>(dev->flags) = 0;
+    const_cast<uint32_t&>(dev->width) = fb->info.xres;
+    const_cast<uint32_t&>(dev->height) = fb->info.yres;
+    const_cast<int&>(dev->stride) = fb->finfo.line_length / bpp;
+    const_cast<int&>(dev->format) = (bpp == 4) ?
+            HAL_PIXEL_FORMAT_BGRA_8888 : HAL_PIXEL_FORMAT_RGB_565;
+    const_cast<float&>(dev->xdpi) = fb->xdpi;
+    const_cast<float&>(dev->ydpi) = fb->ydpi;
+    const_cast<float&>(dev->fps) = fb->fps;
+    const_cast<int&>(dev->minSwapInterval) = 1;
+    const_cast<int&>(dev->maxSwapInterval) = 1;
+    *device = &dev->common;
+    return 0;
+}
+
+/*****************************************************************************/
+
+/*
+ * The capture calls may come from a process that never opened the
+ * framebuffer device, such as a screen grabber. They use their own
+ * read-only mapping and never change the mode.
+ */
+static int captureMapLocked(private_module_t* m)
+{
+    if (m->captureBase)
+        return 0;
+
+    int fd = open("/dev/graphics/fb0", O_RDONLY, 0);
+    if (fd < 0)
+        fd = open("/dev/fb0", O_RDONLY, 0);
+    if (fd < 0)
+        return -errno;
+
+    struct fb_fix_screeninfo finfo;
+    if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    void* vaddr = mmap(0, finfo.smem_len, PROT_READ, MAP_SHARED, fd, 0);
+    if (vaddr == MAP_FAILED) {
+        int err = -errno;
+        LOGE("couldn't map the framebuffer for capture (%s)", strerror(-err));
+        close(fd);
+        return err;
+    }
+    int g2d = fb_blit_open();
+    m->captureFd = fd;
+    m->captureG2dFd = g2d < 0 ? -1 : g2d;
+    m->captureBase = vaddr;
+    return 0;
+}
+
+/*
+ * Where the screen being scanned out is. Our own posts tell when this
+ * process is the compositor, otherwise the driver's pan offset does.
+ */
+static int captureLocked(private_module_t* m, fb_capture_t* capture)
+{
+    int err = captureMapLocked(m);
+    if (err < 0)
+        return err;
+
+    struct fb_fix_screeninfo finfo;
+    struct fb_var_screeninfo info;
+    if (ioctl(m->captureFd, FBIOGET_FSCREENINFO, &finfo) == -1 ||
+            ioctl(m->captureFd, FBIOGET_VSCREENINFO, &info) == -1)
+        return -errno;
+
+    const int bpp = info.bits_per_pixel >> 3;
+    size_t offset = info.yoffset * finfo.line_length + info.xoffset * bpp;
+    if (m->framebuffer && (m->flags & PAGE_FLIP) &&
+            private_handle_t::validate(m->currentBuffer) == 0) {
+        private_handle_t const* hnd =
+                reinterpret_cast<private_handle_t const*>(m->currentBuffer);
+        if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)
+            offset = hnd->offset;
+    }
+
+    capture->base = (uint8_t const*)m->captureBase + offset;
+    capture->phys = finfo.smem_start + offset;
+    capture->width = info.xres;
+    capture->height = info.yres;
+    capture->stride = finfo.line_length / bpp;
+    capture->format = (bpp == 4) ? HAL_PIXEL_FORMAT_BGRA_8888 :
+            HAL_PIXEL_FORMAT_RGB_565;
+    return 0;
+}
+
+int captureFrameBuffer(private_module_t* m, fb_capture_t* capture)
+{
+    if (!capture)
+        return -EINVAL;
+    m->lock.lock();
+    int err = captureLocked(m, capture);
+    m->lock.unlock();
+    return err;
+}
+
+int captureFrameBufferScaled(private_module_t* m, fb_capture_dst_t const* dst)
+{
+    if (!dst || dst->width <= 0 || dst->height <= 0 ||
+            dst->stride < dst->width)
+        return -EINVAL;
+
+    m->lock.lock();
+    fb_capture_t capture;
+    int err = captureLocked(m, &capture);
+    if (err == 0 &&
+            (dst->width > capture.width || dst->height > capture.height)) {
+        // only ever scales down, neither path filters when enlarging
+        err = -EINVAL;
+    }
+    if (err == 0) {
+        const int bpp = (capture.format == HAL_PIXEL_FORMAT_RGB_565) ? 2 : 4;
+        err = -EINVAL;
+        if (dst->phys) {
+            // the blitter reads the screen, not the CPU
+            fb_surface_t s, d;
+            s.phys = capture.phys;
+            s.stride = capture.stride;
+            s.height = capture.height;
+            s.bpp = bpp * 8;
+            d.phys = dst->phys;
+            d.stride = dst->stride;
+            d.height = dst->height;
+            d.bpp = bpp * 8;
+            err = fb_blit_stretch(m->captureG2dFd,
+                    &d, 0, 0, dst->width, dst->height,
+                    &s, 0, 0, capture.width, capture.height);
+        }
+        if (err < 0 && dst->base) {
+            fb_scale_nearest(dst->base, dst->stride * bpp,
+                    dst->width, dst->height,
+                    capture.base, capture.stride * bpp,
+                    capture.width, capture.height, bpp);
+            err = 0;
+        }
+    }
+    m->lock.unlock();
     return err;
 }
 
@@ -302,6 +1702,10 @@ static int fb_close(struct hw_device_t *dev)
 {
     fb_context_t* ctx = (fb_context_t*)dev;
     if (ctx) {
+        fb_idle_stop(ctx);
+        fb_latch_stop(ctx);
+        fb_workers_destroy(ctx->workers);
+        pthread_mutex_destroy(&ctx->timing.lock);
         free(ctx);
     }
     return 0;
@@ -323,33 +1727,94 @@ int fb_device_open(hw_module_t const* module, const char* name,
 
         /* initialize the procs */
         dev->device.common.tag = HARDWARE_DEVICE_TAG;
-        dev->device.common.version = 0;
+        // version 1 so that dumpsys SurfaceFlinger calls dump
+        dev->device.common.version = 1;
         dev->device.common.module = const_cast<hw_module_t*>(module);
         dev->device.common.close = fb_close;
         dev->device.setSwapInterval = fb_setSwapInterval;
         dev->device.post            = fb_post;
         dev->device.setUpdateRect = 0;
+        dev->device.dump            = fb_dump;
+        pthread_mutex_init(&dev->timing.lock, 0);
 
         private_module_t* m = (private_module_t*)module;
         status = mapFrameBuffer(m);
         if (status >= 0) {
             int stride = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
             int format = (m->info.bits_per_pixel == 32)
-                         ? HAL_PIXEL_FORMAT_RGBX_8888
+                         ? HAL_PIXEL_FORMAT_BGRA_8888
                          : HAL_PIXEL_FORMAT_RGB_565;
+            if (m->flags & CONVERT_565) {
+                // composition stays at 32 bpp, fb_post converts
+                stride = m->info.xres;
+                format = HAL_PIXEL_FORMAT_BGRA_8888;
+            }
+            // the compositor sees the screen the way it is mounted
+            const bool swap = (m->rotation == 90 || m->rotation == 270);
+            const uint32_t width = swap ? m->info.yres : m->info.xres;
+            const uint32_t height = swap ? m->info.xres : m->info.yres;
+            if (m->rotation) {
+                const int bpp = m->info.bits_per_pixel >> 3;
+                stride = ((width * bpp + 3) & ~3) / bpp;
+            }
             const_cast<uint32_t&>(dev->device.flags) = 0;
-            const_cast<uint32_t&>(dev->device.width) = m->info.xres;
-            const_cast<uint32_t&>(dev->device.height) = m->info.yres;
+            const_cast<uint32_t&>(dev->device.width) = width;
+            const_cast<uint32_t&>(dev->device.height) = height;
             const_cast<int&>(dev->device.stride) = stride;
             const_cast<int&>(dev->device.format) = format;
-			const_cast<int&>(dev->device.format) = HAL_PIXEL_FORMAT_BGRA_8888;			
-            const_cast<float&>(dev->device.xdpi) = m->xdpi;
-            const_cast<float&>(dev->device.ydpi) = m->ydpi;
+            const_cast<float&>(dev->device.xdpi) = swap ? m->ydpi : m->xdpi;
+            const_cast<float&>(dev->device.ydpi) = swap ? m->xdpi : m->ydpi;
             const_cast<float&>(dev->device.fps) = m->fps;
             const_cast<int&>(dev->device.minSwapInterval) = 1;
             const_cast<int&>(dev->device.maxSwapInterval) = 1;
+
+            char value[PROPERTY_VALUE_MAX];
+            property_get("debug.gralloc.copy_threads", value, "0");
+            int threads = atoi(value);
+            if (!(m->flags & PAGE_FLIP)) {
+                dev->workers = fb_workers_create(threads);
+            }
+            if (!(m->flags & PAGE_FLIP) && !m->rotation) {
+                /*
+                 * We own the front buffer and only copy into it, so the
+                 * compositor's damage can be honored. With page flipping
+                 * the whole back buffer is scanned out, which would need
+                 * the framework to preserve it.
+                 */
+                dev->device.setUpdateRect = fb_setUpdateRect;
+                property_get("debug.gralloc.partial_refresh", value, "0");
+                if (atoi(value)) {
+                    m->flags |= UPDATE_HINT;
+                }
+                property_get("debug.gralloc.beam_chase", value, "0");
+                if (atoi(value) && (m->flags & CONVERT_565)) {
+                    LOGW("can't chase the beam while dithering to 565, "
+                            "copying at once");
+                } else if (atoi(value)) {
+                    m->flags |= BEAM_CHASE;
+                }
+                property_get("debug.gralloc.skip_identical", value, "0");
+                if (atoi(value)) {
+                    m->flags |= SKIP_IDENTICAL;
+                }
+            }
+            property_get("debug.gralloc.copy_bench", value, "0");
+            if (atoi(value)) {
+                fb_workers_t* workers = dev->workers ? dev->workers :
+                        fb_workers_create(threads);
+                const size_t bytes = m->info.xres * (m->info.bits_per_pixel >> 3);
+                fb_copy_benchmark(workers, bytes, m->finfo.line_length,
+                        m->info.yres);
+                fb_convert_benchmark(workers, m->info.xres, m->info.yres);
+                if (workers != dev->workers)
+                    fb_workers_destroy(workers);
+            }
+            fb_idle_start(dev, m);
+            fb_latch_start(dev);
             *device = &dev->device.common;
         }
+    } else if (!strcmp(name, GRALLOC_HARDWARE_FB1)) {
+        status = fb1_device_open(module, device);
     }
     return status;
 }
@@ -28,6 +28,9 @@
 #include <hardware/gralloc.h>
 #include <pthread.h>
 #include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
 
 #include <cutils/native_handle.h>
 
@@ -36,29 +39,160 @@
 struct private_module_t;
 struct private_handle_t;
 
+// private_module_t::flags
+enum {
+    PAGE_FLIP = 0x00000001,
+    LOCKED = 0x00000002,
+    PAN_DISPLAY = 0x00000004,
+    UPDATE_HINT = 0x00000008,
+    BLIT_COPY = 0x00000010,
+    BEAM_CHASE = 0x00000020,
+    SKIP_IDENTICAL = 0x00000040,
+    CONVERT_565 = 0x00000080
+};
+
 inline size_t roundUpToPageSize(size_t x) {
     return (x + (PAGE_SIZE-1)) & ~(PAGE_SIZE-1);
 }
 
+inline int64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec) * 1000000000LL + t.tv_nsec;
+}
+
 int mapFrameBufferLocked(struct private_module_t* module);
+void clearFrameBufferLocked(struct private_module_t* module, uint32_t index);
+int mapSecondaryFrameBufferLocked(struct private_module_t* module);
+void clearSecondaryFrameBufferLocked(struct private_module_t* module,
+        uint32_t index);
+int captureFrameBuffer(struct private_module_t* module,
+        struct fb_capture_t* capture);
+int captureFrameBufferScaled(struct private_module_t* module,
+        struct fb_capture_dst_t const* dst);
 int terminateBuffer(gralloc_module_t const* module, private_handle_t* hnd);
 int mapBuffer(gralloc_module_t const* module, private_handle_t* hnd);
+int dumpMapperLocks(char* buff, int len);
+int getBufferAge(struct private_module_t const* module,
+        private_handle_t const* hnd);
 
 /*****************************************************************************/
 
-class Locker {
-    pthread_mutex_t mutex;
-public:
+// contended waits: <10us, <100us, <1ms, <10ms, 10ms and more
+#define LOCKER_WAIT_BUCKETS 5
+
+#define LOCKER_MAX_SPIN     1000
+// so one bad stretch can't turn spinning off for good
+#define LOCKER_MIN_SPIN     8
+
+/*
+ * A mutex that spins for a while before sleeping when it is taken, and
+ * keeps count of how often and how long callers had to wait. The spin
+ * budget grows when spinning pays off and shrinks when it doesn't.
+ *
+ * There is no constructor, so that a Locker can be part of
+ * HAL_MODULE_INFO_SYM. Initialize it with LOCKER_INITIALIZER or init().
+ * The statistics are only updated by the owner, under the mutex.
+ */
+struct Locker {
     class Autolock {
         Locker& locker;
     public:
         inline Autolock(Locker& locker) : locker(locker) {  locker.lock(); }
         inline ~Autolock() { locker.unlock(); }
     };
-    inline Locker()        { pthread_mutex_init(&mutex, 0); }
-    inline ~Locker()       { pthread_mutex_destroy(&mutex); }
-    inline void lock()     { pthread_mutex_lock(&mutex); }
+
+    pthread_mutex_t mutex;
+    int spinLimit;
+    uint32_t numLocks;
+    uint32_t numContended;
+    uint32_t numSpun;           // contended, but got it while spinning
+    uint64_t waitNs;
+    uint64_t maxWaitNs;
+    uint32_t waits[LOCKER_WAIT_BUCKETS];
+
+    inline void init() {
+        pthread_mutex_init(&mutex, 0);
+        spinLimit = 100;
+        numLocks = numContended = numSpun = 0;
+        waitNs = maxWaitNs = 0;
+        for (int i=0 ; i<LOCKER_WAIT_BUCKETS ; i++)
+            waits[i] = 0;
+    }
+    inline void destroy()  { pthread_mutex_destroy(&mutex); }
+
+    inline void lock() {
+        if (pthread_mutex_trylock(&mutex))
+            lockContended();
+        numLocks++;
+    }
     inline void unlock()   { pthread_mutex_unlock(&mutex); }
+
+    int dump(char* buff, int len, char const* name) const {
+        return snprintf(buff, len,
+                "    %s: %u locks, %u contended (%u while spinning), "
+                "wait avg %.1f us, max %.1f us, spin %d\n"
+                "      waits <10us:%u <100us:%u <1ms:%u <10ms:%u 10ms+:%u\n",
+                name, numLocks, numContended, numSpun,
+                numContended ? waitNs / (1e3 * numContended) : 0.0,
+                maxWaitNs / 1e3, spinLimit,
+                waits[0], waits[1], waits[2], waits[3], waits[4]);
+    }
+
+private:
+    static inline int maxSpin() {
+        // spinning on a single core only delays the owner
+        static int sMaxSpin = -1;
+        if (sMaxSpin < 0)
+            sMaxSpin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? LOCKER_MAX_SPIN : 0;
+        return sMaxSpin;
+    }
+
+    static inline void relax() {
+#if defined(__ARM_ARCH_7A__)
+        __asm__ __volatile__("yield" ::: "memory");
+#elif defined(__i386__) || defined(__x86_64__)
+        __asm__ __volatile__("pause" ::: "memory");
+#endif
+    }
+
+    void lockContended() {
+        const int64_t start = now_ns();
+        const int limit = spinLimit < maxSpin() ? spinLimit : maxSpin();
+        bool spun = false;
+        for (int i=0 ; i<limit && !spun ; i++) {
+            relax();
+            spun = (pthread_mutex_trylock(&mutex) == 0);
+        }
+        if (!spun)
+            pthread_mutex_lock(&mutex);
+
+        // we own it now
+        const int64_t wait = now_ns() - start;
+        numContended++;
+        waitNs += wait;
+        if (uint64_t(wait) > maxWaitNs)
+            maxWaitNs = wait;
+        int bucket = 0;
+        for (int64_t t = wait / 10000 ; t && bucket < LOCKER_WAIT_BUCKETS-1 ;
+                t /= 10) {
+            bucket++;
+        }
+        waits[bucket]++;
+        if (spun) {
+            numSpun++;
+            spinLimit += spinLimit / 4 + 1;
+            if (spinLimit > LOCKER_MAX_SPIN)
+                spinLimit = LOCKER_MAX_SPIN;
+        } else {
+            spinLimit /= 2;
+            if (spinLimit < LOCKER_MIN_SPIN)
+                spinLimit = LOCKER_MIN_SPIN;
+        }
+    }
 };
 
+#define LOCKER_INITIALIZER \
+    { PTHREAD_MUTEX_INITIALIZER, 100, 0, 0, 0, 0, 0, { 0 } }
+
 #endif /* GR_H_ */
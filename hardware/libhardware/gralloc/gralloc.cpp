@@ -22,6 +22,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <stdarg.h>
+
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -30,12 +32,14 @@
 #include <cutils/ashmem.h>
 #include <cutils/log.h>
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #include <hardware/hardware.h>
 #include <hardware/gralloc.h>
 
 #include "gralloc_priv.h"
 #include "gr.h"
+#include "memfd.h"
 
 /*****************************************************************************/
 
@@ -69,6 +73,12 @@ extern int gralloc_register_buffer(gralloc_module_t const* module,
 extern int gralloc_unregister_buffer(gralloc_module_t const* module,
         buffer_handle_t handle);
 
+extern int gralloc_lock_profile_dump(char* buff, int len);
+extern void gralloc_lock_profile_forget(buffer_handle_t handle);
+
+static int gralloc_perform(gralloc_module_t const* module,
+        int operation, ... );
+
 /*****************************************************************************/
 
 static struct hw_module_methods_t gralloc_module_methods = {
@@ -90,12 +100,13 @@ struct private_module_t HAL_MODULE_INFO_SYM = {
         unregisterBuffer: gralloc_unregister_buffer,
         lock: gralloc_lock,
         unlock: gralloc_unlock,
+        perform: gralloc_perform,
     },
     framebuffer: 0,
     flags: 0,
     numBuffers: 0,
     bufferMask: 0,
-    lock: PTHREAD_MUTEX_INITIALIZER,
+    lock: LOCKER_INITIALIZER,
     currentBuffer: 0,
 };
 
@@ -125,10 +136,18 @@ static int gralloc_alloc_framebuffer_locked(alloc_device_t* dev,
         // we return a regular buffer which will be memcpy'ed to the main
         // screen when post is called.
         int newUsage = (usage & ~GRALLOC_USAGE_HW_FB) | GRALLOC_USAGE_HW_2D;
-        return gralloc_alloc_buffer(dev, bufferSize, newUsage, pHandle);
+        // converted posts are rendered deeper than the framebuffer
+        return gralloc_alloc_buffer(dev,
+                (m->flags & CONVERT_565) ? size : bufferSize,
+                newUsage, pHandle);
     }
 
     if (bufferMask >= ((1LU<<numBuffers)-1)) {
+        if (!(m->flags & PAGE_FLIP)) {
+            // fb_post copies anyway, it can copy from a regular buffer
+            int newUsage = (usage & ~GRALLOC_USAGE_HW_FB) | GRALLOC_USAGE_HW_2D;
+            return gralloc_alloc_buffer(dev, bufferSize, newUsage, pHandle);
+        }
         // We ran out of buffers.
         return -ENOMEM;
     }
@@ -149,38 +168,110 @@ static int gralloc_alloc_framebuffer_locked(alloc_device_t* dev,
     
     hnd->base = vaddr;
     hnd->offset = vaddr - intptr_t(m->framebuffer->base);
+    clearFrameBufferLocked(m, hnd->offset / bufferSize);
     *pHandle = hnd;
 
     return 0;
 }
 
+static int gralloc_alloc_fb1_locked(alloc_device_t* dev,
+        size_t size, int usage, buffer_handle_t* pHandle)
+{
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            dev->common.module);
+    private_fb_t* fb = &m->fb1;
+
+    int err = mapSecondaryFrameBufferLocked(m);
+    if (err < 0) {
+        return err;
+    }
+
+    const size_t bufferSize = fb->finfo.line_length * fb->info.yres;
+    if (fb->bufferMask >= ((1LU<<fb->numBuffers)-1) ||
+            !(fb->flags & PAGE_FLIP)) {
+        if (fb->flags & PAGE_FLIP) {
+            return -ENOMEM;
+        }
+        // fb1_post copies it
+        int newUsage = (usage & ~(GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_FB1)) |
+                GRALLOC_USAGE_HW_2D;
+        return gralloc_alloc_buffer(dev, bufferSize, newUsage, pHandle);
+    }
+
+    uint32_t index = 0;
+    while (fb->bufferMask & (1LU<<index))
+        index++;
+    fb->bufferMask |= 1LU<<index;
+
+    private_handle_t* hnd = new private_handle_t(dup(fb->framebuffer->fd), size,
+            private_handle_t::PRIV_FLAGS_FRAMEBUFFER |
+            private_handle_t::PRIV_FLAGS_FB1);
+    hnd->offset = index * bufferSize;
+    hnd->base = fb->framebuffer->base + hnd->offset;
+    clearSecondaryFrameBufferLocked(m, index);
+    *pHandle = hnd;
+    return 0;
+}
+
 static int gralloc_alloc_framebuffer(alloc_device_t* dev,
         size_t size, int usage, buffer_handle_t* pHandle)
 {
     private_module_t* m = reinterpret_cast<private_module_t*>(
             dev->common.module);
-    pthread_mutex_lock(&m->lock);
-    int err = gralloc_alloc_framebuffer_locked(dev, size, usage, pHandle);
-    pthread_mutex_unlock(&m->lock);
+    m->lock.lock();
+    int err = (usage & GRALLOC_USAGE_FB1) ?
+            gralloc_alloc_fb1_locked(dev, size, usage, pHandle) :
+            gralloc_alloc_framebuffer_locked(dev, size, usage, pHandle);
+    m->lock.unlock();
     return err;
 }
 
+/*
+ * debug.gralloc.memfd=1 backs buffers with sealed memfds instead of
+ * ashmem, when the kernel has them. Once it turns out it doesn't, we
+ * stop asking.
+ */
+static int sUseMemfd = -1;
+
+static int gralloc_use_memfd()
+{
+    if (sUseMemfd < 0) {
+        char value[PROPERTY_VALUE_MAX];
+        property_get("debug.gralloc.memfd", value, "0");
+        sUseMemfd = atoi(value) ? 1 : 0;
+    }
+    return sUseMemfd;
+}
+
 static int gralloc_alloc_buffer(alloc_device_t* dev,
         size_t size, int usage, buffer_handle_t* pHandle)
 {
     int err = 0;
     int fd = -1;
+    int flags = 0;
 
     size = roundUpToPageSize(size);
-    
-    fd = ashmem_create_region("gralloc-buffer", size);
+
+    if (gralloc_use_memfd()) {
+        fd = memfd_create_sealed("gralloc-buffer", size);
+        if (fd >= 0) {
+            flags |= private_handle_t::PRIV_FLAGS_SEALED;
+        } else if (fd == -ENOSYS || fd == -EINVAL) {
+            LOGW("no sealed memfd (%s), using ashmem", strerror(-fd));
+            sUseMemfd = 0;
+        }
+    }
+
     if (fd < 0) {
-        LOGE("couldn't create ashmem (%s)", strerror(-errno));
-        err = -errno;
+        fd = ashmem_create_region("gralloc-buffer", size);
+        if (fd < 0) {
+            LOGE("couldn't create ashmem (%s)", strerror(-errno));
+            err = -errno;
+        }
     }
 
     if (err == 0) {
-        private_handle_t* hnd = new private_handle_t(fd, size, 0);
+        private_handle_t* hnd = new private_handle_t(fd, size, flags);
         gralloc_module_t* module = reinterpret_cast<gralloc_module_t*>(
                 dev->common.module);
         err = mapBuffer(module, hnd);
@@ -250,13 +341,22 @@ static int gralloc_free(alloc_device_t* dev,
         return -EINVAL;
 
     private_handle_t const* hnd = reinterpret_cast<private_handle_t const*>(handle);
+    gralloc_lock_profile_forget(handle);
     if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) {
         // free this buffer
         private_module_t* m = reinterpret_cast<private_module_t*>(
                 dev->common.module);
-        const size_t bufferSize = m->finfo.line_length * m->info.yres;
-        int index = (hnd->base - m->framebuffer->base) / bufferSize;
-        m->bufferMask &= ~(1<<index); 
+        if (hnd->flags & private_handle_t::PRIV_FLAGS_FB1) {
+            private_fb_t* fb = &m->fb1;
+            const size_t bufferSize = fb->finfo.line_length * fb->info.yres;
+            m->lock.lock();
+            fb->bufferMask &= ~(1LU<<(hnd->offset / bufferSize));
+            m->lock.unlock();
+        } else {
+            const size_t bufferSize = m->finfo.line_length * m->info.yres;
+            int index = (hnd->base - m->framebuffer->base) / bufferSize;
+            m->bufferMask &= ~(1<<index);
+        }
     } else { 
         gralloc_module_t* module = reinterpret_cast<gralloc_module_t*>(
                 dev->common.module);
@@ -270,6 +370,48 @@ static int gralloc_free(alloc_device_t* dev,
 
 /*****************************************************************************/
 
+static int gralloc_perform(gralloc_module_t const* module,
+        int operation, ... )
+{
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            const_cast<gralloc_module_t*>(module));
+    int res = -EINVAL;
+    va_list args;
+    va_start(args, operation);
+    switch (operation) {
+        case GRALLOC_PERFORM_FB_CAPTURE: {
+            fb_capture_t* capture = va_arg(args, fb_capture_t*);
+            res = captureFrameBuffer(m, capture);
+            break;
+        }
+        case GRALLOC_PERFORM_FB_CAPTURE_SCALED: {
+            fb_capture_dst_t const* dst = va_arg(args, fb_capture_dst_t const*);
+            res = captureFrameBufferScaled(m, dst);
+            break;
+        }
+        case GRALLOC_PERFORM_LOCK_PROFILE: {
+            char* buff = va_arg(args, char*);
+            int len = va_arg(args, int);
+            res = gralloc_lock_profile_dump(buff, len);
+            break;
+        }
+        case GRALLOC_PERFORM_BUFFER_AGE: {
+            buffer_handle_t buffer = va_arg(args, buffer_handle_t);
+            int* age = va_arg(args, int*);
+            if (private_handle_t::validate(buffer) < 0 || !age)
+                break;
+            *age = getBufferAge(m,
+                    reinterpret_cast<private_handle_t const*>(buffer));
+            res = 0;
+            break;
+        }
+    }
+    va_end(args);
+    return res;
+}
+
+/*****************************************************************************/
+
 static int gralloc_close(struct hw_device_t *dev)
 {
     gralloc_context_t* ctx = reinterpret_cast<gralloc_context_t*>(dev);
@@ -29,11 +29,106 @@
 
 #include <linux/fb.h>
 
+#include "gr.h"
+
 /*****************************************************************************/
 
 struct private_module_t;
 struct private_handle_t;
 
+/*
+ * fb1 is the framebuffer the display HAL switches on for TV and HDMI.
+ * Buffers allocated with GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_FB1 are
+ * slots of fb1, for posting to the "fb1" framebuffer device.
+ */
+#define GRALLOC_HARDWARE_FB1 "fb1"
+
+enum {
+    GRALLOC_USAGE_FB1 = GRALLOC_USAGE_PRIVATE_0
+};
+
+/*
+ * Private gralloc_module_t::perform operations.
+ */
+enum {
+    /*
+     * (fb_capture_t* capture)
+     * Describes the screen being scanned out. Nothing is copied, the
+     * pixels are read-only and change with the next post.
+     */
+    GRALLOC_PERFORM_FB_CAPTURE = 0x46420001,
+    /*
+     * (fb_capture_dst_t const* dst)
+     * Scales the screen being scanned out into a smaller buffer, with
+     * G2D when dst->phys is set. -EINVAL if dst is larger than the
+     * screen in either direction.
+     */
+    GRALLOC_PERFORM_FB_CAPTURE_SCALED = 0x46420002,
+    /*
+     * (char* buff, int len)
+     * Writes the CPU lock profile of the calling process, the worst
+     * offenders first. Needs debug.gralloc.lock_profile.
+     */
+    GRALLOC_PERFORM_LOCK_PROFILE = 0x46420003,
+    /*
+     * (buffer_handle_t buffer, int* age)
+     * Posts since the contents of a buffer were last presented, counted
+     * the way EGL_EXT_buffer_age does: 1 if it holds the frame posted
+     * last, 2 the one before, and so on. 0 when it was never posted and
+     * its contents are undefined.
+     *
+     * Only buffers allocated by the calling process are tracked, since
+     * the post counts live in the handle and the framebuffer device of
+     * the process that posts them. A handle imported from another
+     * process always reads 0, so the caller has to redraw everything.
+     * In practice that means the compositor can use it for its
+     * framebuffer slots and its own buffers, and apps can't.
+     */
+    GRALLOC_PERFORM_BUFFER_AGE = 0x46420004
+};
+
+struct fb_capture_t {
+    void const* base;       // first pixel of the screen
+    uint32_t phys;          // physical address of the first pixel
+    int width;
+    int height;
+    int stride;             // in pixels
+    int format;             // HAL_PIXEL_FORMAT_*
+};
+
+struct fb_capture_dst_t {
+    void* base;             // written by the CPU when there is no phys
+    uint32_t phys;          // physically contiguous destination, or 0
+    int width;
+    int height;
+    int stride;             // in pixels, same format as the screen
+};
+
+/*
+ * A framebuffer other than fb0. Only flips, or copies when it can't, none
+ * of fb0's copy path options apply. Its mode is the display HAL's, it is
+ * only ever panned from here.
+ */
+struct private_fb_t {
+    private_handle_t* framebuffer;
+    uint32_t flags;
+    uint32_t numBuffers;
+    uint32_t bufferMask;
+    uint32_t clearedMask;
+    buffer_handle_t currentBuffer;
+    struct fb_var_screeninfo info;
+    struct fb_fix_screeninfo finfo;
+    float xdpi;
+    float ydpi;
+    float fps;
+    uint32_t numFlips;
+    uint32_t numCopies;
+    // resized by the display HAL, the slots out can't be posted
+    bool stale;
+    // successful posts, for buffer ages
+    uint32_t postSeq;
+};
+
 struct private_module_t {
     gralloc_module_t base;
 
@@ -41,7 +136,7 @@ struct private_module_t {
     uint32_t flags;
     uint32_t numBuffers;
     uint32_t bufferMask;
-    pthread_mutex_t lock;
+    Locker lock;
     buffer_handle_t currentBuffer;
     int pmem_master;
     void* pmem_master_base;
@@ -51,6 +146,39 @@ struct private_module_t {
     float xdpi;
     float ydpi;
     float fps;
+    // time to scan out one line, blanking included
+    uint32_t lineTimeNs;
+
+    // successful posts, for buffer ages
+    uint32_t postSeq;
+    // how each fb_post reached the screen
+    uint32_t numPanFlips;
+    uint32_t numPutFlips;
+    uint32_t numCopies;
+    uint32_t numPartialCopies;
+    uint32_t numBlits;
+    uint32_t numLateChases;
+    // identical-frame detection
+    uint32_t numHashedPosts;
+    uint32_t numSkippedPosts;
+    uint64_t hashTimeNs;
+    // clockwise rotation of what's posted, in degrees
+    int rotation;
+    uint32_t numRotations;
+    uint64_t rotateTimeNs;
+
+    // G2D, -1 when unavailable. fb_post only copies with it if BLIT_COPY
+    int g2dFd;
+    // screens already cleared, the others are cleared before first use
+    uint32_t clearedMask;
+
+    // fb1, mapped when first allocated from or opened
+    struct private_fb_t fb1;
+
+    // read-only mapping for the capture calls, 0 until the first one
+    void const* captureBase;
+    int captureFd;
+    int captureG2dFd;
 };
 
 /*****************************************************************************/
@@ -63,7 +191,11 @@ struct private_handle_t {
 #endif
     
     enum {
-        PRIV_FLAGS_FRAMEBUFFER = 0x00000001
+        PRIV_FLAGS_FRAMEBUFFER = 0x00000001,
+        // with PRIV_FLAGS_FRAMEBUFFER, a slot of fb1 rather than fb0
+        PRIV_FLAGS_FB1         = 0x00000002,
+        // a memfd with its size sealed, rather than ashmem
+        PRIV_FLAGS_SEALED      = 0x00000004
     };
 
     // file-descriptors
@@ -77,15 +209,19 @@ struct private_handle_t {
     // FIXME: the attributes below should be out-of-line
     int     base;
     int     pid;
+    // postSeq of the post that last presented it, 0 if never posted
+    int     lastPost;
+    // which framebuffer that post went to, 0 or 1
+    int     lastPostFb;
 
 #ifdef __cplusplus
-    static const int sNumInts = 6;
+    static const int sNumInts = 8;
     static const int sNumFds = 1;
     static const int sMagic = 0x3141592;
 
     private_handle_t(int fd, int size, int flags) :
         fd(fd), magic(sMagic), flags(flags), size(size), offset(0),
-        base(0), pid(getpid())
+        base(0), pid(getpid()), lastPost(0), lastPostFb(0)
     {
         version = sizeof(native_handle);
         numInts = sNumInts;
@@ -18,6 +18,8 @@
 #include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sys/mman.h>
@@ -26,11 +28,14 @@
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #include <hardware/hardware.h>
 #include <hardware/gralloc.h>
 
 #include "gralloc_priv.h"
+#include "gr.h"
+#include "memfd.h"
 
 
 /* desktop Linux needs a little help with gettid() */
@@ -82,7 +87,7 @@ static int gralloc_unmap(gralloc_module_t const* module,
 
 /*****************************************************************************/
 
-static pthread_mutex_t sMapLock = PTHREAD_MUTEX_INITIALIZER; 
+static void profile_forget(buffer_handle_t handle);
 
 /*****************************************************************************/
 
@@ -96,6 +101,15 @@ int gralloc_register_buffer(gralloc_module_t const* module,
     int err = 0;
     private_handle_t* hnd = (private_handle_t*)handle;
     if (hnd->pid != getpid()) {
+        // don't take the sender's word for it, a shrinkable fd could
+        // SIGBUS us later
+        if ((hnd->flags & private_handle_t::PRIV_FLAGS_SEALED) &&
+                !memfd_is_sealed(hnd->fd, hnd->size)) {
+            LOGE("buffer fd=%d is not sealed to %d bytes",
+                    hnd->fd, hnd->size);
+            return -EINVAL;
+        }
+        // mmap is thread-safe and the handle is only ours, nothing to lock
         void *vaddr;
         err = gralloc_map(module, handle, &vaddr);
     }
@@ -115,6 +129,8 @@ int gralloc_unregister_buffer(gralloc_module_t const* module,
             gralloc_unmap(module, handle);
         }
     }
+    // the handle's address may come back for another buffer
+    profile_forget(handle);
     return 0;
 }
 
@@ -136,6 +152,254 @@ int terminateBuffer(gralloc_module_t const* module,
     return 0;
 }
 
+/*****************************************************************************/
+
+/*
+ * CPU access profiling, on with debug.gralloc.lock_profile=<seconds>.
+ * Lock counts, hold times and usage are kept per handle, and the worst
+ * offenders are logged every <seconds>. When it's off, lock and unlock
+ * only test sProfile. Entries go away when their handle is unregistered
+ * or freed; when the table is full anyway, the least locked entry that
+ * isn't locked right now makes room.
+ */
+
+#define PROFILE_SLOTS   256
+#define PROFILE_TOP     10
+
+struct lock_profile_t {
+    buffer_handle_t handle;
+    int         size;
+    uint32_t    numLocks;
+    uint32_t    numReads;
+    uint32_t    numWrites;
+    int         usage;          // every usage bit ever asked for
+    int         nested;         // locks not unlocked yet
+    int64_t     lockedAt;
+    int64_t     holdNs;
+    int64_t     maxHoldNs;
+    pid_t       tid;            // last thread to lock it
+};
+
+static int sProfile = -1;       // until the property was read
+static int64_t sProfileInterval;
+static int64_t sProfileLogged;
+static uint32_t sProfileEvicted;
+static lock_profile_t sProfileSlots[PROFILE_SLOTS];
+static Locker sProfileLock = LOCKER_INITIALIZER;
+
+static void profile_init()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.gralloc.lock_profile", value, "0");
+    const int seconds = atoi(value);
+    sProfileInterval = seconds * 1000000000LL;
+    sProfileLogged = now_ns();
+    sProfile = seconds > 0;
+}
+
+static inline bool profiling()
+{
+    if (__builtin_expect(sProfile == 0, 1))
+        return false;
+    if (sProfile < 0)
+        profile_init();
+    return sProfile > 0;
+}
+
+static inline int profile_home(buffer_handle_t handle)
+{
+    return (uint32_t(uintptr_t(handle) >> 4) * 2654435761U) % PROFILE_SLOTS;
+}
+
+// the entry of handle, 0 when it isn't tracked
+static lock_profile_t* profile_lookup_locked(buffer_handle_t handle)
+{
+    const int home = profile_home(handle);
+    for (int i=0 ; i<PROFILE_SLOTS ; i++) {
+        lock_profile_t* p = &sProfileSlots[(home + i) % PROFILE_SLOTS];
+        if (!p->handle)
+            break;
+        if (p->handle == handle)
+            return p;
+    }
+    return 0;
+}
+
+// the entry of handle, made or taken over from the coldest when it isn't tracked
+static lock_profile_t* profile_find_locked(buffer_handle_t handle)
+{
+    const int home = profile_home(handle);
+    for (int i=0 ; i<PROFILE_SLOTS ; i++) {
+        lock_profile_t* p = &sProfileSlots[(home + i) % PROFILE_SLOTS];
+        if (p->handle == handle)
+            return p;
+        if (!p->handle) {
+            p->handle = handle;
+            return p;
+        }
+    }
+
+    /*
+     * Full: reuse the coldest entry. Every slot is taken, so the new
+     * handle is still found by probing from its home slot.
+     */
+    lock_profile_t* coldest = 0;
+    for (int i=0 ; i<PROFILE_SLOTS ; i++) {
+        lock_profile_t* p = &sProfileSlots[i];
+        if (!p->nested && (!coldest || p->numLocks < coldest->numLocks))
+            coldest = p;
+    }
+    if (coldest) {
+        memset(coldest, 0, sizeof(*coldest));
+        coldest->handle = handle;
+        sProfileEvicted++;
+    }
+    return coldest;
+}
+
+/*
+ * Linear probing deletion: move later entries of the same run back into
+ * the hole when their home slot allows it, so none gets cut off from it.
+ */
+static void profile_remove_locked(lock_profile_t* p)
+{
+    int hole = p - sProfileSlots;
+    memset(&sProfileSlots[hole], 0, sizeof(sProfileSlots[hole]));
+    for (int i=(hole + 1) % PROFILE_SLOTS ; sProfileSlots[i].handle ;
+            i=(i + 1) % PROFILE_SLOTS) {
+        const int home = profile_home(sProfileSlots[i].handle);
+        // can move if its home isn't cyclically in (hole, i]
+        const bool between = (hole < i) ? (home > hole && home <= i) :
+                (home > hole || home <= i);
+        if (!between) {
+            sProfileSlots[hole] = sProfileSlots[i];
+            memset(&sProfileSlots[i], 0, sizeof(sProfileSlots[i]));
+            hole = i;
+        }
+    }
+}
+
+static void profile_forget(buffer_handle_t handle)
+{
+    if (__builtin_expect(sProfile <= 0, 1))
+        return;
+    sProfileLock.lock();
+    lock_profile_t* p = profile_lookup_locked(handle);
+    if (p)
+        profile_remove_locked(p);
+    sProfileLock.unlock();
+}
+
+/*
+ * For gralloc_free, the handle is about to be deleted.
+ */
+void gralloc_lock_profile_forget(buffer_handle_t handle)
+{
+    profile_forget(handle);
+}
+
+static int profile_compare(void const* a, void const* b)
+{
+    lock_profile_t const* pa = *(lock_profile_t const* const*)a;
+    lock_profile_t const* pb = *(lock_profile_t const* const*)b;
+    if (pa->holdNs != pb->holdNs)
+        return pa->holdNs < pb->holdNs ? 1 : -1;
+    return pb->numLocks - pa->numLocks;
+}
+
+static int profile_summary_locked(char* buff, int len)
+{
+    lock_profile_t* sorted[PROFILE_SLOTS];
+    int count = 0;
+    uint32_t numLocks = 0;
+    for (int i=0 ; i<PROFILE_SLOTS ; i++) {
+        if (sProfileSlots[i].handle) {
+            sorted[count++] = &sProfileSlots[i];
+            numLocks += sProfileSlots[i].numLocks;
+        }
+    }
+    qsort(sorted, count, sizeof(sorted[0]), profile_compare);
+
+    int n = snprintf(buff, len,
+            "gralloc CPU locks in pid %d: %u locks on %d buffers "
+            "(%u evicted), top offenders by hold time:\n"
+            "  handle     size     locks  reads writes  hold ms  max ms  "
+            "usage     tid\n",
+            getpid(), numLocks, count, sProfileEvicted);
+    for (int i=0 ; i<count && i<PROFILE_TOP && n<len ; i++) {
+        lock_profile_t const* p = sorted[i];
+        n += snprintf(buff + n, len - n,
+                "  %p %8d %6u %6u %6u %8.2f %7.2f  %08x %5d\n",
+                p->handle, p->size, p->numLocks, p->numReads, p->numWrites,
+                p->holdNs / 1e6, p->maxHoldNs / 1e6, p->usage, p->tid);
+    }
+    return n < len ? n : len - 1;
+}
+
+static void profile_lock(buffer_handle_t handle, int usage)
+{
+    const int64_t now = now_ns();
+    sProfileLock.lock();
+    lock_profile_t* p = profile_find_locked(handle);
+    if (p) {
+        p->size = ((private_handle_t const*)handle)->size;
+        p->numLocks++;
+        if (usage & GRALLOC_USAGE_SW_READ_MASK)
+            p->numReads++;
+        if (usage & GRALLOC_USAGE_SW_WRITE_MASK)
+            p->numWrites++;
+        p->usage |= usage;
+        if (p->nested++ == 0)
+            p->lockedAt = now;
+        p->tid = gettid();
+    }
+    if (now - sProfileLogged >= sProfileInterval) {
+        char buff[2048];
+        profile_summary_locked(buff, sizeof(buff));
+        LOGI("%s", buff);
+        sProfileLogged = now;
+    }
+    sProfileLock.unlock();
+}
+
+static void profile_unlock(buffer_handle_t handle)
+{
+    const int64_t now = now_ns();
+    sProfileLock.lock();
+    // locked before profiling started, or evicted since: nothing to close
+    lock_profile_t* p = profile_lookup_locked(handle);
+    if (p && p->nested > 0 && --p->nested == 0) {
+        const int64_t hold = now - p->lockedAt;
+        p->holdNs += hold;
+        if (hold > p->maxHoldNs)
+            p->maxHoldNs = hold;
+    }
+    sProfileLock.unlock();
+}
+
+/*
+ * Summary of the CPU locks taken in this process so far, for
+ * GRALLOC_PERFORM_LOCK_PROFILE. Fails when profiling is off.
+ */
+int gralloc_lock_profile_dump(char* buff, int len)
+{
+    if (!buff || len <= 0)
+        return -EINVAL;
+    if (!profiling())
+        return -ENOSYS;
+    sProfileLock.lock();
+    int n = profile_summary_locked(buff, len);
+    sProfileLock.unlock();
+    return n;
+}
+
+/*****************************************************************************/
+
+int dumpMapperLocks(char* buff, int len)
+{
+    return sProfileLock.dump(buff, len, "lock profile");
+}
+
 int gralloc_lock(gralloc_module_t const* module,
         buffer_handle_t handle, int usage,
         int l, int t, int w, int h,
@@ -154,6 +418,8 @@ int gralloc_lock(gralloc_module_t const* module,
 
     private_handle_t* hnd = (private_handle_t*)handle;
     *vaddr = (void*)hnd->base;
+    if (profiling())
+        profile_lock(handle, usage);
     return 0;
 }
 
@@ -165,5 +431,7 @@ int gralloc_unlock(gralloc_module_t const* module,
 
     if (private_handle_t::validate(handle) < 0)
         return -EINVAL;
+    if (profiling())
+        profile_unlock(handle);
     return 0;
 }
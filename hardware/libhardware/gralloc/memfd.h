@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2026 The sun4i gralloc HAL contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MEMFD_H_
+#define MEMFD_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/*****************************************************************************/
+
+/*
+ * Neither bionic nor the kernel headers of this tree know about memfd
+ * (Linux 3.17), so the bits we use are spelled out here. On a kernel
+ * without it, memfd_create_sealed() fails with ENOSYS and the caller
+ * falls back to ashmem.
+ */
+
+#ifndef __NR_memfd_create
+# if defined(__arm__)
+#  define __NR_memfd_create     385
+# elif defined(__x86_64__)
+#  define __NR_memfd_create     319
+# elif defined(__i386__)
+#  define __NR_memfd_create     356
+# endif
+#endif
+
+#ifndef MFD_CLOEXEC
+# define MFD_CLOEXEC            0x0001U
+# define MFD_ALLOW_SEALING      0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+# define F_ADD_SEALS            1033
+# define F_GET_SEALS            1034
+# define F_SEAL_SEAL            0x0001
+# define F_SEAL_SHRINK          0x0002
+# define F_SEAL_GROW            0x0004
+#endif
+
+/* what a gralloc memfd is sealed with, its size can never change */
+#define MEMFD_GRALLOC_SEALS     (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/*
+ * Create an anonymous file of 'size' bytes and seal its size. Returns
+ * the fd or -errno.
+ */
+inline int memfd_create_sealed(char const* name, size_t size)
+{
+#if defined(__NR_memfd_create)
+    int fd = syscall(__NR_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -errno;
+    if (ftruncate(fd, size) < 0 ||
+            fcntl(fd, F_ADD_SEALS, MEMFD_GRALLOC_SEALS) < 0) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    return fd;
+#else
+    return -ENOSYS;
+#endif
+}
+
+/*
+ * True if 'fd' is a memfd whose size is sealed and at least 'size'
+ * bytes. Only the kernel is trusted here, not the handle flags: once
+ * this holds, nobody can truncate the file under a mapping of it.
+ */
+inline bool memfd_is_sealed(int fd, size_t size)
+{
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & MEMFD_GRALLOC_SEALS) != MEMFD_GRALLOC_SEALS)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return false;
+    return size_t(st.st_size) >= size;
+}
+
+#endif /* MEMFD_H_ */